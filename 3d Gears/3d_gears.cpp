@@ -5,8 +5,9 @@
  * Authors:
  *		Claude (AI assistant)
  *
- * This screen saver displays three rotating 3D gears with random number of teeth,
- * colors, and positions. The entire scene rotates smoothly in random directions.
+ * This screen saver displays a train of rotating 3D gears with random number of
+ * teeth, colors, and positions: meshing pairs, compound gears sharing an axle and
+ * planetary sets. The entire scene rotates smoothly in random directions.
  *
  * This screen saver was designed and implemented by Claude, an AI assistant
  * created by Anthropic, demonstrating the capabilities of artificial intelligence
@@ -22,12 +23,26 @@
 #include <StringView.h>
 #include <TextView.h>
 #include <ScrollView.h>
+#include <Slider.h>
+#include <CheckBox.h>
 #include <GLView.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include <syslog.h>
+#include <algorithm>
+#include <atomic>
+
+#include "GearScene.h"
+
+// Gear count of the stress test used to smoke-test GL drivers
+static const int32 kStressGearCount = 5000;
+
+// Frame time the adaptive render scale aims for, in milliseconds: 80% of the
+// 20 ms tick, leaving headroom for the rest of the system
+static const double kFrameBudget = 16.0;
 
 class GearScreenSaver;
 
@@ -38,57 +53,54 @@ public:
 	virtual	void				MessageReceived(BMessage* message);
 
 private:
+	static const uint32			kGearCountChanged = 'GcCh';
+	static const uint32			kStressModeChanged = 'GsCh';
+	static const uint32			kRenderScaleChanged = 'GrCh';
+	static const uint32			kAdaptiveScaleChanged = 'GaCh';
+
 			GearScreenSaver*	fSaver;
 			BStringView*		fNameStringView;
 			BTextView*			fInfoTextView;
+			BSlider*			fGearCountSlider;
+			BCheckBox*			fStressModeCheckBox;
+			BSlider*			fRenderScaleSlider;
+			BCheckBox*			fAdaptiveScaleCheckBox;
 };
 
-class Gear {
-public:
-								Gear(int teeth, float moduleSize, float x, float y,
-									float z, float r, float g, float b,
-									float rotationSpeed);
-			void				Draw();
-			void				Rotate();
-			float				Radius() const { return fRadius; }
-			float				ToothHeight() const { return fModuleSize; }
-			int					TeethCount() const { return fTeeth; }
-			float				Rotation() const { return fRotation; }
-
-			float				x;
-			float				y;
-			float				z;
-
-			void				DrawCircleWithHole(float outerRadius, float z,
-									float innerRadius);
-
-			int					fTeeth;
-			float				fModuleSize;
-			float				fRadius;
-			float				fR;
-			float				fG;
-			float				fB;
-			float				fRotation;
-			float				fRotationSpeed;
-};
-
-class GearGLView : public BGLView {
+class GearGLView : public BGLView, public GearContext {
 public:
-								GearGLView(BRect frame);
-								~GearGLView();
+								GearGLView(BRect frame, int32 gearCount);
 
 	virtual	void				AttachedToWindow();
+	virtual	void				DetachedFromWindow();
 	virtual	void				Draw();
 
+			void				SetGearCount(int32 count);
+			void				SetReportFrameTime(bool report)
+									{ fReportFrameTime = report; }
+			void				SetRenderScale(float scale)
+									{ fRenderScale = scale; }
+			void				SetAdaptiveScale(bool adaptive)
+									{ fAdaptiveScale = adaptive; }
+
+	virtual	void				LockContext() { LockGL(); }
+	virtual	void				UnlockContext() { UnlockGL(); }
+	virtual	void				SwapContext() { SwapBuffers(); }
+
 private:
-			void				_SynchronizeGears();
+			void				_BuildTrain(int32 count);
+			void				_ReportFrameTime(bigtime_t frameTime);
 
 			float				fWidth;
 			float				fHeight;
-			Gear*				fGears[3];
-			float				fSceneRotationX;
-			float				fSceneRotationY;
-			float				fSceneRotationZ;
+			GearScene			fScene;
+			std::atomic<int32>	fPendingGearCount;
+			std::atomic<float>	fRenderScale;
+			std::atomic<bool>	fAdaptiveScale;
+			bool				fReportFrameTime;
+			bigtime_t			fFrameTimeSum;
+			int32				fFrameCount;
+			bigtime_t			fStartTime;
 };
 
 class GearScreenSaver : public BScreenSaver {
@@ -97,10 +109,27 @@ public:
 
 	virtual	void				StartConfig(BView* view);
 	virtual	status_t			StartSaver(BView* view, bool preview);
+	virtual	status_t			SaveState(BMessage* into) const;
+			void				RestoreState(BMessage* from);
 	virtual	void				Draw(BView* view, int32 frame);
 
+			void				SetGearCount(int32 count);
+			int32				GetGearCount() const { return fGearCount; }
+			void				SetStressMode(bool stressMode);
+			bool				GetStressMode() const { return fStressMode; }
+			void				SetRenderScale(float scale);
+			float				GetRenderScale() const { return fRenderScale; }
+			void				SetAdaptiveScale(bool adaptive);
+			bool				GetAdaptiveScale() const { return fAdaptiveScale; }
+
 private:
+			int32				_EffectiveGearCount() const;
+
 			GearGLView*			fGLView;
+			int32				fGearCount;
+			bool				fStressMode;
+			float				fRenderScale;
+			bool				fAdaptiveScale;
 };
 
 // Implementation of GearConfigView
@@ -124,8 +153,10 @@ GearConfigView::GearConfigView(BRect frame, GearScreenSaver* saver)
 	fInfoTextView->SetStylable(true);
 
 	fInfoTextView->Insert("©2024 Claude 3.5 Sonnet by Anthropic\n\n");
-	fInfoTextView->Insert("This screen saver displays three rotating 3D gears.\n");
+	fInfoTextView->Insert("This screen saver displays a train of rotating 3D gears.\n");
 	fInfoTextView->Insert("The gears have random number of teeth, colors, and positions.\n");
+	fInfoTextView->Insert("Gears mesh in pairs, share axles as compound gears "
+		"and form planetary sets.\n");
 	fInfoTextView->Insert("The entire scene rotates smoothly in random directions.\n\n");
 	fInfoTextView->Insert("This screen saver was designed and implemented by Claude, "
 		"an AI assistant created by Anthropic, ");
@@ -137,234 +168,88 @@ GearConfigView::GearConfigView(BRect frame, GearScreenSaver* saver)
 	BScrollView* infoScrollView = new BScrollView("infoScrollView", fInfoTextView,
 		B_WILL_DRAW | B_FRAME_EVENTS, false, true);
 
+	fGearCountSlider = new BSlider("gearCountSlider", "Number of gears",
+		new BMessage(kGearCountChanged), 3, 500, B_HORIZONTAL);
+	fGearCountSlider->SetValue(fSaver->GetGearCount());
+	fGearCountSlider->SetLimitLabels("3", "500");
+
+	fStressModeCheckBox = new BCheckBox("stressModeCheckBox",
+		"Stress test: 5,000 gears, frame time logged to syslog",
+		new BMessage(kStressModeChanged));
+	fStressModeCheckBox->SetValue(fSaver->GetStressMode());
+
+	fRenderScaleSlider = new BSlider("renderScaleSlider", "Render scale",
+		new BMessage(kRenderScaleChanged), 25, 100, B_HORIZONTAL);
+	fRenderScaleSlider->SetValue((int32)(fSaver->GetRenderScale() * 100 + 0.5f));
+	fRenderScaleSlider->SetLimitLabels("25%", "100%");
+
+	fAdaptiveScaleCheckBox = new BCheckBox("adaptiveScaleCheckBox",
+		"Lower the render scale automatically when frames are slow",
+		new BMessage(kAdaptiveScaleChanged));
+	fAdaptiveScaleCheckBox->SetValue(fSaver->GetAdaptiveScale());
+
 	BGroupLayout* layout = new BGroupLayout(B_VERTICAL);
 	SetLayout(layout);
 
 	layout->SetInsets(B_USE_DEFAULT_SPACING);
 
 	layout->AddView(fNameStringView);    
+	layout->AddView(fGearCountSlider);
+	layout->AddView(fStressModeCheckBox);
+	layout->AddView(fRenderScaleSlider);
+	layout->AddView(fAdaptiveScaleCheckBox);
 	layout->AddView(infoScrollView);
 }
 
 void
 GearConfigView::AttachedToWindow()
 {
+	fGearCountSlider->SetTarget(this);
+	fStressModeCheckBox->SetTarget(this);
+	fRenderScaleSlider->SetTarget(this);
+	fAdaptiveScaleCheckBox->SetTarget(this);
 }
 
 void
 GearConfigView::MessageReceived(BMessage* message)
 {
-}
-
-// Implementation of Gear
-
-Gear::Gear(int teeth, float moduleSize, float x, float y, float z,
-	float r, float g, float b, float rotationSpeed)
-	:
-	fTeeth(teeth),
-	fModuleSize(moduleSize),
-	fRadius(teeth * moduleSize / 2),
-	x(x),
-	y(y),
-	z(z),
-	fR(r),
-	fG(g),
-	fB(b),
-	fRotation(0),
-	fRotationSpeed(rotationSpeed)
-{
-}
-
-void
-Gear::Draw()
-{
-	glPushMatrix();
-	glTranslatef(x, y, z);
-	glRotatef(fRotation, 0, 0, 1);
-
-	float toothHeight = fModuleSize;
-	float outerRadius = fRadius + toothHeight;
-	float innerRadius = fRadius;
-	float thickness = 0.3f * fRadius;
-	float toothAngle = 2 * M_PI / fTeeth;
-	float toothWidthInner = fRadius * sinf(toothAngle / 2);
-	float toothWidthOuter = toothWidthInner * 1.6f;
-
-	// Define the bevel thickness for the outer edges of the teeth
-	float bevelThickness = 0.1f * thickness;
-
-	// Draw teeth
-	glBegin(GL_QUADS);
-	for (int i = 0; i < fTeeth; i++) {
-		float angle = i * toothAngle;
-		
-		// Outer face of the tooth
-		glNormal3f(cosf(angle + toothAngle / 2), sinf(angle + toothAngle / 2), 0);
-		glVertex3f(outerRadius * cosf(angle + toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothWidthOuter / (2 * outerRadius)),
-			thickness / 2 - bevelThickness);
-		glVertex3f(outerRadius * cosf(angle + toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothWidthOuter / (2 * outerRadius)),
-			-thickness / 2 + bevelThickness);
-		glVertex3f(outerRadius * cosf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			-thickness / 2 + bevelThickness);
-		glVertex3f(outerRadius * cosf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			thickness / 2 - bevelThickness);
-
-		// Top face of the tooth
-		glNormal3f(0, 0, 1);
-		glVertex3f(outerRadius * cosf(angle + toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothWidthOuter / (2 * outerRadius)),
-			thickness / 2 - bevelThickness);
-		glVertex3f(outerRadius * cosf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			thickness / 2 - bevelThickness);
-		glVertex3f(fRadius * cosf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			thickness / 2);
-		glVertex3f(fRadius * cosf(angle + toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothWidthInner / (2 * fRadius)),
-			thickness / 2);
-		
-		// Bottom face of the tooth
-		glNormal3f(0, 0, -1);
-		glVertex3f(outerRadius * cosf(angle + toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothWidthOuter / (2 * outerRadius)),
-			-thickness / 2 + bevelThickness);
-		glVertex3f(fRadius * cosf(angle + toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothWidthInner / (2 * fRadius)),
-			-thickness / 2);
-		glVertex3f(fRadius * cosf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			-thickness / 2);
-		glVertex3f(outerRadius * cosf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			-thickness / 2 + bevelThickness);
-
-		// Side faces of the tooth with bevel
-		glNormal3f(-sinf(angle + toothWidthInner / (2 * fRadius)),
-			cosf(angle + toothWidthInner / (2 * fRadius)), 0);
-		glVertex3f(outerRadius * cosf(angle + toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothWidthOuter / (2 * outerRadius)),
-			thickness / 2 - bevelThickness);
-		glVertex3f(fRadius * cosf(angle + toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothWidthInner / (2 * fRadius)),
-			thickness / 2);
-		glVertex3f(fRadius * cosf(angle + toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothWidthInner / (2 * fRadius)),
-			-thickness / 2);
-		glVertex3f(outerRadius * cosf(angle + toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothWidthOuter / (2 * outerRadius)),
-			-thickness / 2 + bevelThickness);
-
-		glNormal3f(sinf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			-cosf(angle + toothAngle - toothWidthInner / (2 * fRadius)), 0);
-		glVertex3f(outerRadius * cosf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			thickness / 2 - bevelThickness);
-		glVertex3f(outerRadius * cosf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			outerRadius * sinf(angle + toothAngle - toothWidthOuter / (2 * outerRadius)),
-			-thickness / 2 + bevelThickness);
-		glVertex3f(fRadius * cosf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			-thickness / 2);
-		glVertex3f(fRadius * cosf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			fRadius * sinf(angle + toothAngle - toothWidthInner / (2 * fRadius)),
-			thickness / 2);
-	}
-	glEnd();
-
-	// Draw gear body (cylinder)
-	glBegin(GL_QUAD_STRIP);
-	for (int i = 0; i <= fTeeth * 16; i++) {
-		float angle = i * (toothAngle / 16);
-		glNormal3f(-cosf(angle), -sinf(angle), 0);
-		glVertex3f(innerRadius * cosf(angle), innerRadius * sinf(angle), thickness / 2);
-		glVertex3f(innerRadius * cosf(angle), innerRadius * sinf(angle), -thickness / 2);
+	switch (message->what) {
+		case kGearCountChanged:
+			fSaver->SetGearCount(fGearCountSlider->Value());
+			break;
+		case kStressModeChanged:
+			fSaver->SetStressMode(fStressModeCheckBox->Value() == B_CONTROL_ON);
+			break;
+		case kRenderScaleChanged:
+			fSaver->SetRenderScale(fRenderScaleSlider->Value() / 100.0f);
+			break;
+		case kAdaptiveScaleChanged:
+			fSaver->SetAdaptiveScale(
+				fAdaptiveScaleCheckBox->Value() == B_CONTROL_ON);
+			break;
+		default:
+			BView::MessageReceived(message);
 	}
-	glEnd();
-
-	// Draw front and back surfaces with a hole
-	DrawCircleWithHole(innerRadius, thickness / 2, 0.2f * innerRadius);
-	DrawCircleWithHole(innerRadius, -thickness / 2, 0.2f * innerRadius);
-	
-	// Draw cylinder connecting the holes
-	glBegin(GL_QUAD_STRIP);
-	for (int i = 0; i <= 360; i += 10) {
-		float angle = i * M_PI / 180.0f;
-		float x = 0.2f * innerRadius * cosf(angle);
-		float y = 0.2f * innerRadius * sinf(angle);
-		glNormal3f(cosf(angle), sinf(angle), 0);
-		glVertex3f(x, y, thickness / 2);
-		glVertex3f(x, y, -thickness / 2);
-	}
-	glEnd();
-
-	glPopMatrix();
-}
-
-void
-Gear::Rotate()
-{
-	fRotation += fRotationSpeed;
-	if (fRotation >= 360.0f)
-		fRotation -= 360.0f;
-}
-
-void
-Gear::DrawCircleWithHole(float outerRadius, float z, float innerRadius)
-{
-	glBegin(GL_TRIANGLE_STRIP);
-	glNormal3f(0, 0, z > 0 ? 1 : -1);
-	for (int i = 0; i <= 360; i += 10) {
-		float angle = i * M_PI / 180.0f;
-		glVertex3f(innerRadius * cosf(angle), innerRadius * sinf(angle), z);
-		glVertex3f(outerRadius * cosf(angle), outerRadius * sinf(angle), z);
-	}
-	glEnd();
 }
 
 // Implementation of GearGLView
 
-GearGLView::GearGLView(BRect frame)
+GearGLView::GearGLView(BRect frame, int32 gearCount)
 	:
 	BGLView(frame, "GearGLView", B_FOLLOW_ALL, B_WILL_DRAW, BGL_RGB | BGL_DOUBLE | BGL_DEPTH),
 	fWidth(frame.Width()),
 	fHeight(frame.Height()),
-	fSceneRotationX(0),
-	fSceneRotationY(0),
-	fSceneRotationZ(0)
+	fPendingGearCount(0),
+	fRenderScale(1.0f),
+	fAdaptiveScale(false),
+	fReportFrameTime(false),
+	fFrameTimeSum(0),
+	fFrameCount(0),
+	fStartTime(0)
 {
 	srand(time(NULL));
 
-	float moduleSize = 0.075f;
-	float baseSpeed = (rand() % 100 + 50) / 100.0f;
-
-	for (int i = 0; i < 3; i++) {
-		int teeth = (rand() % 10) * 2 + 7;
-		float r = 0.15f + (rand() % 75) / 75.0f;
-		float g = 0.15f + (rand() % 75) / 75.0f;
-		float b = 0.15f + (rand() % 75) / 75.0f;
-		float speed = baseSpeed * (i % 2 == 0 ? 1 : -1) * 20.0f / teeth;
-		fGears[i] = new Gear(teeth, moduleSize, 0, 0, 0, r, g, b, speed);
-	}
-
-	float gearSpacing = moduleSize;
-	fGears[0]->x = -(fGears[0]->Radius() + fGears[1]->Radius() + gearSpacing);
-	fGears[1]->x = 0;
-	fGears[2]->x = fGears[1]->Radius() + fGears[2]->Radius() + gearSpacing;
-
-	// Synchronize gear rotations
-	_SynchronizeGears();
-}
-
-GearGLView::~GearGLView()
-{
-	for (int i = 0; i < 3; i++) {
-		delete fGears[i];
-	}
+	_BuildTrain(gearCount);
 }
 
 void
@@ -372,77 +257,80 @@ GearGLView::AttachedToWindow()
 {
 	BGLView::AttachedToWindow();
 	LockGL();
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
-	glEnable(GL_COLOR_MATERIAL);
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	
-	GLfloat light_position[] = { 1.0f, 1.0f, 1.0f, 0.0f };
-	GLfloat light_ambient[] = { 0.2f, 0.2f, 0.2f, 1.0f };
-	GLfloat light_diffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-	GLfloat light_specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-	
-	glLightfv(GL_LIGHT0, GL_POSITION, light_position);
-	glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);
-	glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
-	glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
-	
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(45.0, fWidth / fHeight, 0.1, 100.0);
-	glMatrixMode(GL_MODELVIEW);
+	fScene.InitGL((int)fWidth + 1, (int)fHeight + 1);
 	UnlockGL();
 }
 
 void
-GearGLView::Draw()
+GearGLView::DetachedFromWindow()
 {
 	LockGL();
+	fScene.ReleaseGL();
+	UnlockGL();
+	BGLView::DetachedFromWindow();
+}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glLoadIdentity();
-	glTranslatef(0.0f, 0.0f, -5.0f);
+void
+GearGLView::Draw()
+{
+	bigtime_t frameStart = system_time();
+
+	// Gear count changes from the config view are applied between frames
+	int32 pendingCount = fPendingGearCount.exchange(0);
+	if (pendingCount > 0) {
+		LockGL();
+		_BuildTrain(pendingCount);
+		UnlockGL();
+	}
 
-	glRotatef(fSceneRotationX, 1.0f, 0.0f, 0.0f);
-	glRotatef(fSceneRotationY, 0.0f, 1.0f, 0.0f);
-	glRotatef(fSceneRotationZ, 0.0f, 0.0f, 1.0f);
+	RenderScaler& scaler = fScene.Scaler();
+	scaler.SetMaxScale(fRenderScale);
+	scaler.SetAdaptive(fAdaptiveScale, kFrameBudget);
 
-	for (int i = 0; i < 3; i++) {
-		glPushMatrix();
-		glColor3f(fGears[i]->fR, fGears[i]->fG, fGears[i]->fB);
-		fGears[i]->Draw();
-		fGears[i]->Rotate();
-		glPopMatrix();
-	}
+	// Everything is a function of the elapsed time on the monotonic clock
+	fScene.DrawFrame(*this, (frameStart - fStartTime) / 1000000.0);
 
-	fSceneRotationX += 0.2f;
-	fSceneRotationY += 0.25f;
-	fSceneRotationZ += 0.1f;
+	bigtime_t frameTime = system_time() - frameStart;
+	scaler.AddFrameTime(frameTime / 1000.0);
+	if (fReportFrameTime)
+		_ReportFrameTime(frameTime);
+}
 
-	SwapBuffers();
-	UnlockGL();
+void
+GearGLView::SetGearCount(int32 count)
+{
+	fPendingGearCount = count;
 }
 
 void
-GearGLView::_SynchronizeGears()
+GearGLView::_BuildTrain(int32 count)
 {
-	// Angles per tooth for each gear
-	float anglePerTooth1 = 360.0f / fGears[0]->TeethCount();
-	float anglePerTooth2 = 360.0f / fGears[1]->TeethCount();
-	float anglePerTooth3 = 360.0f / fGears[2]->TeethCount();
-
-	// Synchronize first and second gears
-	float rotationRatio12 = (float)fGears[0]->TeethCount() / (float)fGears[1]->TeethCount();
-	fGears[1]->fRotation = fGears[0]->Rotation() * rotationRatio12;
-	
-	// Synchronize second and third gears
-	float rotationRatio23 = (float)fGears[1]->TeethCount() / (float)fGears[2]->TeethCount();
-	fGears[2]->fRotation = fGears[1]->Rotation() * rotationRatio23;
+	float baseSpeed = (rand() % 100 + 50) / 100.0f;
+
+	// The driver passes baseSpeed * 20 / 360 teeth per 20 ms tick as
+	// before, the solver derives the speed and tooth phase of every other
+	// gear from it.
+	fScene.Build(count, baseSpeed * 20.0 / 360.0 * 50.0);
+	fStartTime = system_time();
+	fFrameTimeSum = 0;
+	fFrameCount = 0;
+}
 
-	// Ensure gears rotate in opposite directions
-	fGears[1]->fRotationSpeed = -fGears[0]->fRotationSpeed * rotationRatio12;
-	fGears[2]->fRotationSpeed = -fGears[1]->fRotationSpeed * rotationRatio23;
+void
+GearGLView::_ReportFrameTime(bigtime_t frameTime)
+{
+	fFrameTimeSum += frameTime;
+	if (++fFrameCount < 250)
+		return;
+
+	syslog(LOG_INFO,
+		"3D Gears: %d gears, %d drawn, %.2f ms/frame (%s, %d%% scale)",
+		fScene.Train().CountGears(), fScene.Renderer().CountDrawnGears(),
+		fFrameTimeSum / 1000.0 / fFrameCount,
+		fScene.Renderer().PathName(),
+		(int)(fScene.Scaler().Scale() * 100 + 0.5f));
+	fFrameTimeSum = 0;
+	fFrameCount = 0;
 }
 
 // Implementation of GearScreenSaver
@@ -450,8 +338,13 @@ GearGLView::_SynchronizeGears()
 GearScreenSaver::GearScreenSaver(BMessage* archive, image_id image)
 	:
 	BScreenSaver(archive, image),
-	fGLView(NULL)
+	fGLView(NULL),
+	fGearCount(24),
+	fStressMode(false),
+	fRenderScale(1.0f),
+	fAdaptiveScale(false)
 {
+	RestoreState(archive);
 }
 
 void
@@ -466,7 +359,10 @@ GearScreenSaver::StartSaver(BView* view, bool preview)
 {
 	if (fGLView == NULL) {
 		BRect bounds = view->Bounds();
-		fGLView = new GearGLView(bounds);
+		fGLView = new GearGLView(bounds, _EffectiveGearCount());
+		fGLView->SetReportFrameTime(fStressMode);
+		fGLView->SetRenderScale(fRenderScale);
+		fGLView->SetAdaptiveScale(fAdaptiveScale);
 		view->AddChild(fGLView);
 	}
 
@@ -475,6 +371,30 @@ GearScreenSaver::StartSaver(BView* view, bool preview)
 	return B_OK;
 }
 
+status_t
+GearScreenSaver::SaveState(BMessage* into) const
+{
+	into->AddInt32("gear_count", fGearCount);
+	into->AddBool("stress_mode", fStressMode);
+	into->AddFloat("render_scale", fRenderScale);
+	into->AddBool("adaptive_scale", fAdaptiveScale);
+	return B_OK;
+}
+
+void
+GearScreenSaver::RestoreState(BMessage* from)
+{
+	if (from == NULL || from->FindInt32("gear_count", &fGearCount) != B_OK)
+		fGearCount = 24;
+	if (from == NULL || from->FindBool("stress_mode", &fStressMode) != B_OK)
+		fStressMode = false;
+	if (from == NULL || from->FindFloat("render_scale", &fRenderScale) != B_OK)
+		fRenderScale = 1.0f;
+	fRenderScale = std::max(RenderScaler::kMinScale, std::min(1.0f, fRenderScale));
+	if (from == NULL || from->FindBool("adaptive_scale", &fAdaptiveScale) != B_OK)
+		fAdaptiveScale = false;
+}
+
 void
 GearScreenSaver::Draw(BView* view, int32 frame)
 {
@@ -483,6 +403,46 @@ GearScreenSaver::Draw(BView* view, int32 frame)
 	}
 }
 
+void
+GearScreenSaver::SetGearCount(int32 count)
+{
+	fGearCount = count;
+	if (fGLView != NULL)
+		fGLView->SetGearCount(_EffectiveGearCount());
+}
+
+void
+GearScreenSaver::SetStressMode(bool stressMode)
+{
+	fStressMode = stressMode;
+	if (fGLView != NULL) {
+		fGLView->SetReportFrameTime(stressMode);
+		fGLView->SetGearCount(_EffectiveGearCount());
+	}
+}
+
+void
+GearScreenSaver::SetRenderScale(float scale)
+{
+	fRenderScale = scale;
+	if (fGLView != NULL)
+		fGLView->SetRenderScale(scale);
+}
+
+void
+GearScreenSaver::SetAdaptiveScale(bool adaptive)
+{
+	fAdaptiveScale = adaptive;
+	if (fGLView != NULL)
+		fGLView->SetAdaptiveScale(adaptive);
+}
+
+int32
+GearScreenSaver::_EffectiveGearCount() const
+{
+	return fStressMode ? kStressGearCount : fGearCount;
+}
+
 // Screensaver hook
 extern "C" _EXPORT BScreenSaver*
 instantiate_screen_saver(BMessage* message, image_id image)
@@ -0,0 +1,609 @@
+/*
+ * GearRenderer.cpp
+ *
+ * Shared-mesh gear renderer for the 3D Gears screen saver, with an
+ * instanced path for GL 3.3 and a CPU batching fallback.
+ */
+
+#define GL_GLEXT_PROTOTYPES 1
+
+#include "GearRenderer.h"
+
+#include <GL/glext.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+
+// Generic attribute slots for the per-instance data; kept clear of the slots
+// some drivers alias to the fixed-function vertex, normal and color arrays.
+static const GLuint kOffsetAttribute = 6;
+static const GLuint kRotationAttribute = 7;
+static const GLuint kColorAttribute = 8;
+
+// x, y, z, cos(rotation), sin(rotation), r, g, b
+static const int kInstanceFloats = 8;
+
+// Fallback batches are flushed in chunks of whole triangles
+static const int kBatchVertices = 3 * 21845;
+
+static const char* kVertexShaderSource =
+	"#version 120\n"
+	"attribute vec3 instanceOffset;\n"
+	"attribute vec2 instanceRotation;\n"
+	"attribute vec3 instanceColor;\n"
+	"void main() {\n"
+	"	float c = instanceRotation.x;\n"
+	"	float s = instanceRotation.y;\n"
+	"	vec3 position = vec3(c * gl_Vertex.x - s * gl_Vertex.y,\n"
+	"		s * gl_Vertex.x + c * gl_Vertex.y, gl_Vertex.z) + instanceOffset;\n"
+	"	vec3 normal = vec3(c * gl_Normal.x - s * gl_Normal.y,\n"
+	"		s * gl_Normal.x + c * gl_Normal.y, gl_Normal.z);\n"
+	"	vec3 eyeNormal = normalize(gl_NormalMatrix * normal);\n"
+	"	vec3 light = normalize(gl_LightSource[0].position.xyz);\n"
+	"	float diffuse = max(dot(eyeNormal, light), 0.0);\n"
+	"	vec3 lighting = gl_LightModel.ambient.rgb\n"
+	"		+ gl_LightSource[0].ambient.rgb\n"
+	"		+ gl_LightSource[0].diffuse.rgb * diffuse;\n"
+	"	gl_FrontColor = vec4(instanceColor * lighting, 1.0);\n"
+	"	gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 1.0);\n"
+	"}\n";
+
+static const char* kFragmentShaderSource =
+	"#version 120\n"
+	"void main() {\n"
+	"	gl_FragColor = gl_Color;\n"
+	"}\n";
+
+
+static GLuint
+compile_shader(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+
+	GLint status = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+
+// #pragma mark - mesh building
+
+
+static GearVertex
+vertex(float radius, float angle, float z, float nx, float ny, float nz)
+{
+	GearVertex result = { radius * cosf(angle), radius * sinf(angle), z,
+		nx, ny, nz };
+	return result;
+}
+
+
+// Quad a-b-c-d, counter-clockwise when seen from the side it faces; meshes
+// are closed and consistently wound so back faces can be culled. With
+// "reversed" the quad is emitted the other way round.
+static void
+add_quad(std::vector<GearVertex>& vertices, const GearVertex& a,
+	const GearVertex& b, const GearVertex& c, const GearVertex& d,
+	bool reversed = false)
+{
+	const GearVertex& second = reversed ? d : b;
+	const GearVertex& fourth = reversed ? b : d;
+	vertices.push_back(a);
+	vertices.push_back(second);
+	vertices.push_back(c);
+	vertices.push_back(a);
+	vertices.push_back(c);
+	vertices.push_back(fourth);
+}
+
+
+// Flat annulus between two radii, facing +z or -z
+static void
+add_disc(std::vector<GearVertex>& vertices, float outerRadius, float z,
+	float innerRadius)
+{
+	float nz = z > 0 ? 1 : -1;
+	for (int i = 0; i < 360; i += 10) {
+		float angle = i * M_PI / 180.0f;
+		float next = (i + 10) * M_PI / 180.0f;
+		add_quad(vertices, vertex(innerRadius, angle, z, 0, 0, nz),
+			vertex(outerRadius, angle, z, 0, 0, nz),
+			vertex(outerRadius, next, z, 0, 0, nz),
+			vertex(innerRadius, next, z, 0, 0, nz), nz < 0);
+	}
+}
+
+
+// Cylinder wall around the z axis with radial normals pointing to "facing"
+static void
+add_wall(std::vector<GearVertex>& vertices, float radius, float thickness,
+	int segments, float facing)
+{
+	for (int i = 0; i < segments; i++) {
+		float angle = 2 * M_PI * i / segments;
+		float next = 2 * M_PI * (i + 1) / segments;
+		add_quad(vertices,
+			vertex(radius, angle, thickness / 2,
+				facing * cosf(angle), facing * sinf(angle), 0),
+			vertex(radius, angle, -thickness / 2,
+				facing * cosf(angle), facing * sinf(angle), 0),
+			vertex(radius, next, -thickness / 2,
+				facing * cosf(next), facing * sinf(next), 0),
+			vertex(radius, next, thickness / 2,
+				facing * cosf(next), facing * sinf(next), 0), facing < 0);
+	}
+}
+
+
+void
+GearRenderer::BuildMesh(const Gear& gear, std::vector<GearVertex>& vertices)
+{
+	vertices.clear();
+
+	// Ring gears have their teeth pointing inwards, so their tips lie
+	// inside the roots, the tip faces look towards the axle and the tooth
+	// outlines run the other way round.
+	bool internal = gear.fInternal;
+	float rootRadius = gear.RootRadius();
+	float tipRadius = gear.TipRadius();
+	float tipFacing = internal ? -1.0f : 1.0f;
+	float thickness = gear.fThickness;
+	float toothAngle = 2 * M_PI / gear.fTeeth;
+	float toothWidthRoot = rootRadius * sinf(toothAngle / 2);
+	float toothWidthTip = toothWidthRoot * 1.6f;
+
+	// Define the bevel thickness for the outer edges of the teeth
+	float bevelThickness = 0.1f * thickness;
+	float tipTop = thickness / 2 - bevelThickness;
+
+	for (int i = 0; i < gear.fTeeth; i++) {
+		float angle = i * toothAngle;
+		float tipStart = angle + toothWidthTip / (2 * tipRadius);
+		float tipEnd = angle + toothAngle - toothWidthTip / (2 * tipRadius);
+		float rootStart = angle + toothWidthRoot / (2 * rootRadius);
+		float rootEnd = angle + toothAngle - toothWidthRoot / (2 * rootRadius);
+
+		// Tip face of the tooth
+		float nx = tipFacing * cosf(angle + toothAngle / 2);
+		float ny = tipFacing * sinf(angle + toothAngle / 2);
+		add_quad(vertices, vertex(tipRadius, tipStart, tipTop, nx, ny, 0),
+			vertex(tipRadius, tipStart, -tipTop, nx, ny, 0),
+			vertex(tipRadius, tipEnd, -tipTop, nx, ny, 0),
+			vertex(tipRadius, tipEnd, tipTop, nx, ny, 0), internal);
+
+		// Top and bottom faces of the tooth
+		add_quad(vertices, vertex(tipRadius, tipStart, tipTop, 0, 0, 1),
+			vertex(tipRadius, tipEnd, tipTop, 0, 0, 1),
+			vertex(rootRadius, rootEnd, thickness / 2, 0, 0, 1),
+			vertex(rootRadius, rootStart, thickness / 2, 0, 0, 1), internal);
+		add_quad(vertices, vertex(tipRadius, tipStart, -tipTop, 0, 0, -1),
+			vertex(rootRadius, rootStart, -thickness / 2, 0, 0, -1),
+			vertex(rootRadius, rootEnd, -thickness / 2, 0, 0, -1),
+			vertex(tipRadius, tipEnd, -tipTop, 0, 0, -1), internal);
+
+		// Side faces of the tooth with bevel
+		nx = sinf(rootStart);
+		ny = -cosf(rootStart);
+		add_quad(vertices, vertex(tipRadius, tipStart, tipTop, nx, ny, 0),
+			vertex(rootRadius, rootStart, thickness / 2, nx, ny, 0),
+			vertex(rootRadius, rootStart, -thickness / 2, nx, ny, 0),
+			vertex(tipRadius, tipStart, -tipTop, nx, ny, 0), internal);
+
+		nx = -sinf(rootEnd);
+		ny = cosf(rootEnd);
+		add_quad(vertices, vertex(tipRadius, tipEnd, tipTop, nx, ny, 0),
+			vertex(tipRadius, tipEnd, -tipTop, nx, ny, 0),
+			vertex(rootRadius, rootEnd, -thickness / 2, nx, ny, 0),
+			vertex(rootRadius, rootEnd, thickness / 2, nx, ny, 0), internal);
+	}
+
+	// Gear body (cylinder); four segments per tooth are enough for the
+	// little of it that shows between the teeth.
+	add_wall(vertices, rootRadius, thickness, gear.fTeeth * 4, tipFacing);
+
+	if (internal) {
+		// Ring gears carry a solid rim outside of the tooth roots
+		float rimRadius = gear.OuterRadius();
+		add_disc(vertices, rimRadius, thickness / 2, rootRadius);
+		add_disc(vertices, rimRadius, -thickness / 2, rootRadius);
+		add_wall(vertices, rimRadius, thickness, 72, 1.0f);
+		return;
+	}
+
+	// Front and back surfaces with a hole, and the cylinder connecting them
+	add_disc(vertices, rootRadius, thickness / 2, 0.2f * rootRadius);
+	add_disc(vertices, rootRadius, -thickness / 2, 0.2f * rootRadius);
+	add_wall(vertices, 0.2f * rootRadius, thickness, 36, -1.0f);
+}
+
+
+// #pragma mark - GearFrustum
+
+
+void
+GearFrustum::SetFromGL()
+{
+	float modelview[16];
+	float projection[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	glGetFloatv(GL_PROJECTION_MATRIX, projection);
+	Set(modelview, projection);
+}
+
+
+void
+GearFrustum::Set(const float* modelview, const float* projection)
+{
+	// Clip matrix = projection * modelview, both column-major
+	float clip[16];
+	for (int column = 0; column < 4; column++) {
+		for (int row = 0; row < 4; row++) {
+			float sum = 0;
+			for (int k = 0; k < 4; k++)
+				sum += projection[k * 4 + row] * modelview[column * 4 + k];
+			clip[column * 4 + row] = sum;
+		}
+	}
+
+	// A point is inside when -w <= x, y, z <= w in clip space; each plane
+	// is the fourth row of the clip matrix plus or minus one of the others.
+	for (int i = 0; i < 6; i++) {
+		int row = i / 2;
+		float sign = (i & 1) != 0 ? -1.0f : 1.0f;
+		float length = 0;
+		for (int column = 0; column < 4; column++) {
+			fPlanes[i][column] = clip[column * 4 + 3]
+				+ sign * clip[column * 4 + row];
+			if (column < 3)
+				length += fPlanes[i][column] * fPlanes[i][column];
+		}
+		length = sqrtf(length);
+		if (length > 0) {
+			for (int column = 0; column < 4; column++)
+				fPlanes[i][column] /= length;
+		}
+	}
+}
+
+
+bool
+GearFrustum::IntersectsSphere(float x, float y, float z, float radius) const
+{
+	for (int i = 0; i < 6; i++) {
+		const float* plane = fPlanes[i];
+		if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < -radius)
+			return false;
+	}
+	return true;
+}
+
+
+// #pragma mark - GearRenderer
+
+
+bool
+GearRenderer::GLVersionAtLeast(int major, int minor)
+{
+	const char* version = (const char*)glGetString(GL_VERSION);
+	int versionMajor = 0;
+	int versionMinor = 0;
+	if (version == NULL
+		|| sscanf(version, "%d.%d", &versionMajor, &versionMinor) != 2)
+		return false;
+
+	return versionMajor > major
+		|| (versionMajor == major && versionMinor >= minor);
+}
+
+
+GearRenderer::GearRenderer()
+	:
+	fPath(GEAR_RENDER_BATCHED),
+	fInitialized(false),
+	fDrawnGears(0),
+	fProgram(0),
+	fInstanceBuffer(0)
+{
+}
+
+
+void
+GearRenderer::Init()
+{
+	// Drivers that cannot build the shader get the fixed-function path
+	fPath = GEAR_RENDER_BATCHED;
+	if (GLVersionAtLeast(3, 3) && _InitShader()) {
+		glGenBuffers(1, &fInstanceBuffer);
+		fPath = GEAR_RENDER_INSTANCED;
+	}
+	fInitialized = true;
+}
+
+
+void
+GearRenderer::Release()
+{
+	_ReleaseMeshes();
+	if (fInstanceBuffer != 0)
+		glDeleteBuffers(1, &fInstanceBuffer);
+	if (fProgram != 0)
+		glDeleteProgram(fProgram);
+	fInstanceBuffer = 0;
+	fProgram = 0;
+	fInitialized = false;
+}
+
+
+void
+GearRenderer::SetTrain(const GearTrain& train)
+{
+	_ReleaseMeshes();
+
+	for (int i = 0; i < train.CountGears(); i++) {
+		const Gear& gear = train.GearAt(i);
+
+		size_t group = 0;
+		while (group < fGroups.size()
+			&& (fGroups[group].teeth != gear.fTeeth
+				|| fGroups[group].internal != gear.fInternal
+				|| fGroups[group].thickness != gear.fThickness))
+			group++;
+
+		if (group == fGroups.size()) {
+			MeshGroup mesh;
+			mesh.teeth = gear.fTeeth;
+			mesh.internal = gear.fInternal;
+			mesh.thickness = gear.fThickness;
+			mesh.buffer = 0;
+			mesh.drawn = 0;
+			BuildMesh(gear, mesh.vertices);
+			fGroups.push_back(mesh);
+		}
+		fGroups[group].gears.push_back(i);
+	}
+
+	if (fPath == GEAR_RENDER_INSTANCED) {
+		for (size_t i = 0; i < fGroups.size(); i++) {
+			MeshGroup& mesh = fGroups[i];
+			glGenBuffers(1, &mesh.buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, mesh.buffer);
+			glBufferData(GL_ARRAY_BUFFER,
+				mesh.vertices.size() * sizeof(GearVertex), &mesh.vertices[0],
+				GL_STATIC_DRAW);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		fInstanceData.resize(train.CountGears() * kInstanceFloats);
+	} else
+		fBatch.resize(kBatchVertices);
+}
+
+
+void
+GearRenderer::Draw(const GearTrain& train, const GearFrustum& frustum)
+{
+	fDrawnGears = 0;
+	if (!fInitialized || train.CountGears() == 0)
+		return;
+
+	if (fPath == GEAR_RENDER_INSTANCED)
+		_DrawInstanced(train, frustum);
+	else
+		_DrawBatched(train, frustum);
+}
+
+
+const char*
+GearRenderer::PathName() const
+{
+	return fPath == GEAR_RENDER_INSTANCED ? "instanced" : "batched";
+}
+
+
+bool
+GearRenderer::_InitShader()
+{
+	GLuint vertexShader = compile_shader(GL_VERTEX_SHADER, kVertexShaderSource);
+	GLuint fragmentShader = compile_shader(GL_FRAGMENT_SHADER,
+		kFragmentShaderSource);
+	if (vertexShader == 0 || fragmentShader == 0) {
+		if (vertexShader != 0)
+			glDeleteShader(vertexShader);
+		if (fragmentShader != 0)
+			glDeleteShader(fragmentShader);
+		return false;
+	}
+
+	fProgram = glCreateProgram();
+	glAttachShader(fProgram, vertexShader);
+	glAttachShader(fProgram, fragmentShader);
+	glBindAttribLocation(fProgram, kOffsetAttribute, "instanceOffset");
+	glBindAttribLocation(fProgram, kRotationAttribute, "instanceRotation");
+	glBindAttribLocation(fProgram, kColorAttribute, "instanceColor");
+	glLinkProgram(fProgram);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(fProgram, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		glDeleteProgram(fProgram);
+		fProgram = 0;
+		return false;
+	}
+	return true;
+}
+
+
+void
+GearRenderer::_ReleaseMeshes()
+{
+	for (size_t i = 0; i < fGroups.size(); i++) {
+		if (fGroups[i].buffer != 0)
+			glDeleteBuffers(1, &fGroups[i].buffer);
+	}
+	fGroups.clear();
+}
+
+
+void
+GearRenderer::_DrawInstanced(const GearTrain& train,
+	const GearFrustum& frustum)
+{
+	// Fill the instance data of the visible gears in mesh order so that
+	// every mesh reads one contiguous range of the buffer.
+	float* instance = &fInstanceData[0];
+	for (size_t i = 0; i < fGroups.size(); i++) {
+		MeshGroup& mesh = fGroups[i];
+		mesh.drawn = 0;
+		for (size_t j = 0; j < mesh.gears.size(); j++) {
+			const Gear& gear = train.GearAt(mesh.gears[j]);
+			if (!frustum.IntersectsSphere(gear.x, gear.y, gear.z,
+					gear.BoundingRadius()))
+				continue;
+
+			float angle = gear.Rotation() * M_PI / 180.0f;
+			instance[0] = gear.x;
+			instance[1] = gear.y;
+			instance[2] = gear.z;
+			instance[3] = cosf(angle);
+			instance[4] = sinf(angle);
+			instance[5] = gear.fR;
+			instance[6] = gear.fG;
+			instance[7] = gear.fB;
+			instance += kInstanceFloats;
+			mesh.drawn++;
+		}
+		fDrawnGears += mesh.drawn;
+	}
+	if (fDrawnGears == 0)
+		return;
+
+	// Orphan the previous frame's storage instead of waiting for it
+	size_t size = fDrawnGears * kInstanceFloats * sizeof(float);
+	glBindBuffer(GL_ARRAY_BUFFER, fInstanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, fInstanceData.size() * sizeof(float), NULL,
+		GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, &fInstanceData[0]);
+
+	glUseProgram(fProgram);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableVertexAttribArray(kOffsetAttribute);
+	glEnableVertexAttribArray(kRotationAttribute);
+	glEnableVertexAttribArray(kColorAttribute);
+	glVertexAttribDivisor(kOffsetAttribute, 1);
+	glVertexAttribDivisor(kRotationAttribute, 1);
+	glVertexAttribDivisor(kColorAttribute, 1);
+
+	const GLsizei stride = kInstanceFloats * sizeof(float);
+	size_t first = 0;
+	for (size_t i = 0; i < fGroups.size(); i++) {
+		const MeshGroup& mesh = fGroups[i];
+		if (mesh.drawn == 0)
+			continue;
+
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.buffer);
+		glVertexPointer(3, GL_FLOAT, sizeof(GearVertex), (void*)0);
+		glNormalPointer(GL_FLOAT, sizeof(GearVertex),
+			(void*)(3 * sizeof(float)));
+
+		const char* base = (const char*)(first * stride);
+		glBindBuffer(GL_ARRAY_BUFFER, fInstanceBuffer);
+		glVertexAttribPointer(kOffsetAttribute, 3, GL_FLOAT, GL_FALSE, stride,
+			base);
+		glVertexAttribPointer(kRotationAttribute, 2, GL_FLOAT, GL_FALSE,
+			stride, base + 3 * sizeof(float));
+		glVertexAttribPointer(kColorAttribute, 3, GL_FLOAT, GL_FALSE, stride,
+			base + 5 * sizeof(float));
+
+		glDrawArraysInstanced(GL_TRIANGLES, 0, mesh.vertices.size(),
+			mesh.drawn);
+		first += mesh.drawn;
+	}
+
+	glVertexAttribDivisor(kOffsetAttribute, 0);
+	glVertexAttribDivisor(kRotationAttribute, 0);
+	glVertexAttribDivisor(kColorAttribute, 0);
+	glDisableVertexAttribArray(kOffsetAttribute);
+	glDisableVertexAttribArray(kRotationAttribute);
+	glDisableVertexAttribArray(kColorAttribute);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glUseProgram(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void
+GearRenderer::_DrawBatched(const GearTrain& train, const GearFrustum& frustum)
+{
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+
+	int count = 0;
+	for (size_t i = 0; i < fGroups.size(); i++) {
+		const MeshGroup& mesh = fGroups[i];
+		for (size_t j = 0; j < mesh.gears.size(); j++) {
+			const Gear& gear = train.GearAt(mesh.gears[j]);
+			if (!frustum.IntersectsSphere(gear.x, gear.y, gear.z,
+					gear.BoundingRadius()))
+				continue;
+
+			fDrawnGears++;
+			float angle = gear.Rotation() * M_PI / 180.0f;
+			float c = cosf(angle);
+			float s = sinf(angle);
+			GLubyte color[4] = {
+				(GLubyte)std::min(255.0f, gear.fR * 255.0f),
+				(GLubyte)std::min(255.0f, gear.fG * 255.0f),
+				(GLubyte)std::min(255.0f, gear.fB * 255.0f),
+				255
+			};
+
+			for (size_t k = 0; k < mesh.vertices.size(); k++) {
+				if (count == kBatchVertices) {
+					_FlushBatch(count);
+					count = 0;
+				}
+
+				const GearVertex& source = mesh.vertices[k];
+				BatchVertex& target = fBatch[count++];
+				target.x = c * source.x - s * source.y + gear.x;
+				target.y = s * source.x + c * source.y + gear.y;
+				target.z = source.z + gear.z;
+				target.nx = c * source.nx - s * source.ny;
+				target.ny = s * source.nx + c * source.ny;
+				target.nz = source.nz;
+				memcpy(target.color, color, sizeof(color));
+			}
+		}
+	}
+	if (count > 0)
+		_FlushBatch(count);
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+
+void
+GearRenderer::_FlushBatch(int count)
+{
+	const BatchVertex* batch = &fBatch[0];
+	glVertexPointer(3, GL_FLOAT, sizeof(BatchVertex), &batch->x);
+	glNormalPointer(GL_FLOAT, sizeof(BatchVertex), &batch->nx);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), batch->color);
+	glDrawArrays(GL_TRIANGLES, 0, count);
+}
@@ -0,0 +1,116 @@
+/*
+ * GearRenderer.h
+ *
+ * Draws a GearTrain with shared meshes: every distinct gear shape is built
+ * once, and all gears using it are drawn together. On GL 3.3 and newer the
+ * per-gear placement and color are streamed from one instance buffer and
+ * each mesh is a single instanced draw call; older GL versions fall back to
+ * transforming the gears on the CPU into one batched vertex array. Gears
+ * whose bounding sphere lies outside of the view frustum are skipped.
+ *
+ * This file has no Haiku dependencies; a current GL context is expected.
+ */
+
+#ifndef GEAR_RENDERER_H
+#define GEAR_RENDERER_H
+
+#include <GL/gl.h>
+
+#include <vector>
+
+#include "GearTrain.h"
+
+enum GearRenderPath {
+	GEAR_RENDER_INSTANCED,
+	GEAR_RENDER_BATCHED
+};
+
+struct GearVertex {
+			float				x;
+			float				y;
+			float				z;
+			float				nx;
+			float				ny;
+			float				nz;
+};
+
+// The six clip planes of the view volume in the coordinate system of the
+// current modelview matrix, with normals pointing inwards.
+class GearFrustum {
+public:
+			// Takes the current GL modelview and projection matrices
+			void				SetFromGL();
+			void				Set(const float* modelview,
+									const float* projection);
+
+			bool				IntersectsSphere(float x, float y, float z,
+									float radius) const;
+
+private:
+			float				fPlanes[6][4];
+};
+
+class GearRenderer {
+public:
+								GearRenderer();
+
+			// Both need the GL context to be current.
+			void				Init();
+			void				Release();
+
+			void				SetTrain(const GearTrain& train);
+			void				Draw(const GearTrain& train,
+									const GearFrustum& frustum);
+			// Gears that passed the frustum test in the last Draw()
+			int					CountDrawnGears() const
+									{ return fDrawnGears; }
+
+			GearRenderPath		Path() const { return fPath; }
+			const char*			PathName() const;
+
+	static	void				BuildMesh(const Gear& gear,
+									std::vector<GearVertex>& vertices);
+	static	bool				GLVersionAtLeast(int major, int minor);
+
+private:
+	struct MeshGroup {
+			int					teeth;
+			bool				internal;
+			float				thickness;
+			std::vector<GearVertex> vertices;
+			GLuint				buffer;
+			std::vector<int>	gears;
+			int					drawn;
+	};
+
+	struct BatchVertex {
+			float				x;
+			float				y;
+			float				z;
+			float				nx;
+			float				ny;
+			float				nz;
+			GLubyte				color[4];
+	};
+
+			bool				_InitShader();
+			void				_ReleaseMeshes();
+			void				_DrawInstanced(const GearTrain& train,
+									const GearFrustum& frustum);
+			void				_DrawBatched(const GearTrain& train,
+									const GearFrustum& frustum);
+			void				_FlushBatch(int count);
+
+			GearRenderPath		fPath;
+			bool				fInitialized;
+			std::vector<MeshGroup> fGroups;
+			int					fDrawnGears;
+
+			GLuint				fProgram;
+			GLuint				fInstanceBuffer;
+			std::vector<float>	fInstanceData;
+
+			std::vector<BatchVertex> fBatch;
+};
+
+#endif // GEAR_RENDERER_H
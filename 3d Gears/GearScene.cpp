@@ -0,0 +1,164 @@
+/*
+ * GearScene.cpp
+ *
+ * Scene setup and drawing for the 3D Gears screen saver.
+ */
+
+#include "GearScene.h"
+
+#include <GL/gl.h>
+#include <GL/glu.h>
+
+#include <math.h>
+
+#include <algorithm>
+
+
+// Scene rotation in degrees per second around the x, y and z axes
+static const double kSceneRotationRate[3] = { 10.0, 12.5, 5.0 };
+
+// Random layouts tried before giving up on a train that can turn
+static const int kBuildAttempts = 8;
+
+
+GearScene::GearScene()
+	:
+	fGLReady(false),
+	fWidth(1),
+	fHeight(1),
+	fProjectionDirty(true),
+	fCenterX(0),
+	fCenterY(0),
+	fCenterZ(0),
+	fSceneRadius(1),
+	fCameraDistance(5)
+{
+}
+
+
+bool
+GearScene::Build(int gearCount, double toothRate)
+{
+	bool solved = false;
+	for (int attempt = 0; attempt < kBuildAttempts && !solved; attempt++) {
+		fTrain.Build(gearCount, 0.075f);
+		solved = fTrain.Solve(0, toothRate);
+	}
+	if (!solved) {
+		// A closed loop of the last layout would jam; show it standing
+		// still rather than with gears turning through each other.
+		fTrain.Solve(0, 0.0);
+	}
+
+	fTrain.GetBounds(fCenterX, fCenterY, fCenterZ, fSceneRadius);
+	// Keep the whole spinning scene within the 45 degree field of view
+	fCameraDistance = std::max(5.0f, fSceneRadius / sinf(22.5f * M_PI / 180.0f));
+	fProjectionDirty = true;
+
+	if (fGLReady)
+		fRenderer.SetTrain(fTrain);
+
+	return solved;
+}
+
+
+void
+GearScene::InitGL(int width, int height)
+{
+	glEnable(GL_DEPTH_TEST);
+	// Gear meshes are closed and wound counter-clockwise
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_LIGHTING);
+	glEnable(GL_LIGHT0);
+	glEnable(GL_COLOR_MATERIAL);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	GLfloat light_position[] = { 1.0f, 1.0f, 1.0f, 0.0f };
+	GLfloat light_ambient[] = { 0.2f, 0.2f, 0.2f, 1.0f };
+	GLfloat light_diffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	GLfloat light_specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	glLightfv(GL_LIGHT0, GL_POSITION, light_position);
+	glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);
+	glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
+	glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
+
+	SetViewSize(width, height);
+	_UpdateProjection();
+	fRenderer.Init();
+	fRenderer.SetTrain(fTrain);
+	fScaler.Init();
+	fGLReady = true;
+}
+
+
+void
+GearScene::ReleaseGL()
+{
+	fRenderer.Release();
+	fScaler.Release();
+	fGLReady = false;
+}
+
+
+void
+GearScene::SetViewSize(int width, int height)
+{
+	fWidth = std::max(1, width);
+	fHeight = std::max(1, height);
+	fScaler.SetViewSize(fWidth, fHeight);
+	fProjectionDirty = true;
+}
+
+
+void
+GearScene::DrawFrame(GearContext& context, double seconds)
+{
+	context.LockContext();
+	_Render(seconds);
+	context.SwapContext();
+	context.UnlockContext();
+}
+
+
+void
+GearScene::_UpdateProjection()
+{
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluPerspective(45.0, (double)fWidth / fHeight, 0.1,
+		fCameraDistance + fSceneRadius + 1.0);
+	glMatrixMode(GL_MODELVIEW);
+	fProjectionDirty = false;
+}
+
+
+void
+GearScene::_Render(double seconds)
+{
+	if (fProjectionDirty)
+		_UpdateProjection();
+
+	bool scaled = fScaler.Begin();
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glLoadIdentity();
+	glTranslatef(0.0f, 0.0f, -fCameraDistance);
+
+	// Everything is a function of the elapsed time, so the animation speed
+	// does not depend on the frame rate and dropped frames are simply
+	// skipped over.
+	glRotated(fmod(seconds * kSceneRotationRate[0], 360.0), 1.0, 0.0, 0.0);
+	glRotated(fmod(seconds * kSceneRotationRate[1], 360.0), 0.0, 1.0, 0.0);
+	glRotated(fmod(seconds * kSceneRotationRate[2], 360.0), 0.0, 0.0, 1.0);
+	glTranslatef(-fCenterX, -fCenterY, -fCenterZ);
+
+	GearFrustum frustum;
+	frustum.SetFromGL();
+
+	fTrain.Update(seconds);
+	fRenderer.Draw(fTrain, frustum);
+
+	if (scaled)
+		fScaler.End();
+}
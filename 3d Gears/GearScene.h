@@ -0,0 +1,76 @@
+/*
+ * GearScene.h
+ *
+ * The complete 3D Gears scene: the gear train, its camera and the GL state
+ * needed to draw it. The scene only talks to the window system through the
+ * small GearContext interface, so the same setup and draw code runs in the
+ * Haiku BGLView and in the headless benchmark.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef GEAR_SCENE_H
+#define GEAR_SCENE_H
+
+#include "GearRenderer.h"
+#include "GearTrain.h"
+#include "RenderScaler.h"
+
+class GearContext {
+public:
+	virtual						~GearContext() {}
+
+	// Makes the GL context current for the calling thread
+	virtual	void				LockContext() = 0;
+	virtual	void				UnlockContext() = 0;
+	// Presents the finished frame
+	virtual	void				SwapContext() = 0;
+};
+
+class GearScene {
+public:
+								GearScene();
+
+			// Builds a new train; toothRate is the number of driver teeth
+			// passing per second. Returns false if no layout could be
+			// solved, in which case the train stands still. Needs the
+			// context to be locked once the GL resources exist.
+			bool				Build(int gearCount, double toothRate);
+
+			// Both need the context to be locked.
+			void				InitGL(int width, int height);
+			void				ReleaseGL();
+
+			void				SetViewSize(int width, int height);
+
+			// Draws the scene as it is the given number of seconds after
+			// Build(). The context is locked for the frame and swapped at
+			// its end.
+			void				DrawFrame(GearContext& context,
+									double seconds);
+
+			const GearTrain&	Train() const { return fTrain; }
+			const GearRenderer&	Renderer() const { return fRenderer; }
+			RenderScaler&		Scaler() { return fScaler; }
+
+private:
+			void				_UpdateProjection();
+			void				_Render(double seconds);
+
+			GearTrain			fTrain;
+			GearRenderer		fRenderer;
+			RenderScaler		fScaler;
+			bool				fGLReady;
+
+			int					fWidth;
+			int					fHeight;
+			bool				fProjectionDirty;
+
+			float				fCenterX;
+			float				fCenterY;
+			float				fCenterZ;
+			float				fSceneRadius;
+			float				fCameraDistance;
+};
+
+#endif // GEAR_SCENE_H
@@ -0,0 +1,568 @@
+/*
+ * GearTrain.cpp
+ *
+ * Gear-train model, speed/phase solver and procedural layout for the
+ * 3D Gears screen saver.
+ *
+ * Tooth phase is measured in teeth: a gear rotated by "rotation" degrees has
+ * a tooth centred on world direction psi when
+ *	teeth * (psi - rotation) / 360 - 0.5
+ * is an integer. Two meshing gears keep a constant relation between their
+ * tooth phases at the contact direction, which is what the solver enforces.
+ */
+
+#include "GearTrain.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <queue>
+
+
+static const double kPhaseTolerance = 1e-3;
+static const double kScaleTolerance = 1e-9;
+
+
+static double
+fraction(double value)
+{
+	return value - floor(value);
+}
+
+
+static double
+tooth_phase(const Gear& gear, double direction)
+{
+	return fraction(gear.fTeeth * (direction - gear.fPhase) / 360.0 - 0.5);
+}
+
+
+static double
+direction_to(const Gear& from, const Gear& to)
+{
+	return atan2((double)to.y - from.y, (double)to.x - from.x) * 180.0 / M_PI;
+}
+
+
+static int
+random_teeth(int minimum, int maximum)
+{
+	return minimum + rand() % (maximum - minimum + 1);
+}
+
+
+// #pragma mark - Gear
+
+
+Gear::Gear(int teeth, float moduleSize, bool internal)
+	:
+	x(0),
+	y(0),
+	z(0),
+	fTeeth(teeth),
+	fModuleSize(moduleSize),
+	fRadius(teeth * moduleSize / 2),
+	fThickness(0.3f * teeth * moduleSize / 2),
+	fInternal(internal),
+	fLayer(0),
+	fR(1),
+	fG(1),
+	fB(1),
+	fPhase(0),
+	fToothScale(0),
+	fDirection(0),
+	fRotation(0)
+{
+}
+
+
+void
+Gear::Update(double driverTeeth)
+{
+	// Wrap to whole revolutions before scaling to degrees, so the angle
+	// keeps full precision no matter how far the train has turned.
+	double teeth = fmod(fToothScale * driverTeeth, fTeeth);
+	fRotation = (float)(fPhase + fDirection * 360.0 * teeth / fTeeth);
+}
+
+
+float
+Gear::RootRadius() const
+{
+	return fInternal ? fRadius + 2 * fModuleSize : fRadius;
+}
+
+
+float
+Gear::OuterRadius() const
+{
+	// A ring gear carries a solid rim outside of its tooth roots
+	return fInternal ? RootRadius() + 1.5f * fModuleSize : TipRadius();
+}
+
+
+float
+Gear::BoundingRadius() const
+{
+	float outer = OuterRadius();
+	return sqrtf(outer * outer + fThickness * fThickness / 4);
+}
+
+
+// #pragma mark - GearSpatialIndex
+
+
+GearSpatialIndex::GearSpatialIndex(float cellSize)
+	:
+	fCellSize(cellSize)
+{
+}
+
+
+void
+GearSpatialIndex::Clear(float cellSize)
+{
+	fCellSize = cellSize;
+	fCells.clear();
+}
+
+
+void
+GearSpatialIndex::Insert(int id, float x, float y, float radius, int layer)
+{
+	Entry entry = { id, x, y, radius };
+
+	int minX = _Cell(x - radius);
+	int maxX = _Cell(x + radius);
+	int minY = _Cell(y - radius);
+	int maxY = _Cell(y + radius);
+	for (int cellY = minY; cellY <= maxY; cellY++) {
+		for (int cellX = minX; cellX <= maxX; cellX++)
+			fCells[_Key(cellX, cellY, layer)].push_back(entry);
+	}
+}
+
+
+bool
+GearSpatialIndex::IsFree(float x, float y, float radius, int layer,
+	int ignore) const
+{
+	int minX = _Cell(x - radius);
+	int maxX = _Cell(x + radius);
+	int minY = _Cell(y - radius);
+	int maxY = _Cell(y + radius);
+	for (int cellY = minY; cellY <= maxY; cellY++) {
+		for (int cellX = minX; cellX <= maxX; cellX++) {
+			std::unordered_map<long long, std::vector<Entry> >::const_iterator
+				cell = fCells.find(_Key(cellX, cellY, layer));
+			if (cell == fCells.end())
+				continue;
+
+			for (size_t i = 0; i < cell->second.size(); i++) {
+				const Entry& entry = cell->second[i];
+				if (entry.id == ignore)
+					continue;
+				float dx = entry.x - x;
+				float dy = entry.y - y;
+				float reach = entry.radius + radius;
+				if (dx * dx + dy * dy < reach * reach)
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+long long
+GearSpatialIndex::_Key(int cellX, int cellY, int layer) const
+{
+	return ((long long)layer << 48)
+		^ ((long long)(cellX & 0xffffff) << 24)
+		^ (long long)(cellY & 0xffffff);
+}
+
+
+int
+GearSpatialIndex::_Cell(float coordinate) const
+{
+	return (int)floorf(coordinate / fCellSize);
+}
+
+
+// #pragma mark - GearTrain
+
+
+GearTrain::GearTrain()
+	:
+	fLayerSpacing(0),
+	fToothRate(0)
+{
+}
+
+
+void
+GearTrain::Clear()
+{
+	fGears.clear();
+	fLinks.clear();
+	fIndex.Clear(1.0f);
+}
+
+
+int
+GearTrain::AddGear(const Gear& gear)
+{
+	fGears.push_back(gear);
+	return (int)fGears.size() - 1;
+}
+
+
+void
+GearTrain::AddLink(int a, int b, GearLinkType type)
+{
+	GearLink link = { a, b, type };
+	fLinks.push_back(link);
+}
+
+
+int
+GearTrain::Build(int gearCount, float moduleSize)
+{
+	Clear();
+
+	// Thickest external gear is 0.3 * 25 teeth * module / 2
+	fLayerSpacing = 5.0f * moduleSize;
+	fIndex.Clear(16.0f * moduleSize);
+
+	Gear driver(random_teeth(3, 12) * 2 + 1, moduleSize);
+	driver.fLayer = kLayerCount / 2;
+	driver.z = driver.fLayer * fLayerSpacing;
+	_SetRandomColor(driver);
+	_Register(AddGear(driver));
+
+	int attempts = 0;
+	while (CountGears() < gearCount && attempts++ < gearCount * 20) {
+		// Prefer recent gears as parents so the train spreads outwards
+		// instead of crowding around the driver.
+		int count = CountGears();
+		int parent = rand() % 2 == 0
+			? count - 1 - rand() % std::min(count, 8) : rand() % count;
+
+		int action = rand() % 100;
+		if (action < 10)
+			_AddCompoundGear(parent, moduleSize);
+		else if (action < 16 && count + 7 <= gearCount)
+			_AddPlanetarySet(parent, moduleSize);
+		else
+			_AddMeshedGear(parent, moduleSize);
+	}
+
+	return CountGears();
+}
+
+
+bool
+GearTrain::Solve(int driver, double toothRate)
+{
+	int count = CountGears();
+	std::vector<std::vector<int> > adjacency(count);
+	for (size_t i = 0; i < fLinks.size(); i++) {
+		adjacency[fLinks[i].a].push_back(i);
+		adjacency[fLinks[i].b].push_back(i);
+	}
+
+	std::vector<bool> solved(count, false);
+	for (int i = 0; i < count; i++) {
+		fGears[i].fToothScale = 0;
+		fGears[i].fDirection = 0;
+		fGears[i].fPhase = 0;
+	}
+
+	bool consistent = true;
+	std::queue<int> pending;
+	fToothRate = toothRate;
+	fGears[driver].fToothScale = 1.0;
+	fGears[driver].fDirection = 1;
+	solved[driver] = true;
+	pending.push(driver);
+
+	while (!pending.empty()) {
+		int current = pending.front();
+		pending.pop();
+
+		for (size_t i = 0; i < adjacency[current].size(); i++) {
+			const GearLink& link = fLinks[adjacency[current][i]];
+			int other = link.a == current ? link.b : link.a;
+			Gear expected = fGears[other];
+			_Propagate(fGears[current], expected, link.type);
+
+			if (!solved[other]) {
+				fGears[other] = expected;
+				solved[other] = true;
+				pending.push(other);
+				continue;
+			}
+
+			// Closed loop, e.g. a ring gear driven by several planets
+			const Gear& unknown = fGears[other];
+			double phaseError = (expected.fPhase - unknown.fPhase)
+				* unknown.fTeeth / 360.0;
+			phaseError -= round(phaseError);
+			if (expected.fDirection != unknown.fDirection
+				|| fabs(expected.fToothScale - unknown.fToothScale)
+					> kScaleTolerance * unknown.fToothScale
+				|| fabs(phaseError) > kPhaseTolerance)
+				consistent = false;
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+		fGears[i].fRotation = (float)fGears[i].fPhase;
+
+	return consistent;
+}
+
+
+void
+GearTrain::Update(double seconds)
+{
+	double driverTeeth = seconds * fToothRate;
+	for (size_t i = 0; i < fGears.size(); i++)
+		fGears[i].Update(driverTeeth);
+}
+
+
+void
+GearTrain::GetBounds(float& centerX, float& centerY, float& centerZ,
+	float& radius) const
+{
+	centerX = centerY = centerZ = radius = 0;
+	if (fGears.empty())
+		return;
+
+	float minX = fGears[0].x, maxX = fGears[0].x;
+	float minY = fGears[0].y, maxY = fGears[0].y;
+	float minZ = fGears[0].z, maxZ = fGears[0].z;
+	for (size_t i = 0; i < fGears.size(); i++) {
+		const Gear& gear = fGears[i];
+		float outer = gear.OuterRadius();
+		minX = std::min(minX, gear.x - outer);
+		maxX = std::max(maxX, gear.x + outer);
+		minY = std::min(minY, gear.y - outer);
+		maxY = std::max(maxY, gear.y + outer);
+		minZ = std::min(minZ, gear.z - gear.fThickness / 2);
+		maxZ = std::max(maxZ, gear.z + gear.fThickness / 2);
+	}
+
+	centerX = (minX + maxX) / 2;
+	centerY = (minY + maxY) / 2;
+	centerZ = (minZ + maxZ) / 2;
+
+	for (size_t i = 0; i < fGears.size(); i++) {
+		const Gear& gear = fGears[i];
+		float dx = gear.x - centerX;
+		float dy = gear.y - centerY;
+		float dz = gear.z - centerZ;
+		float reach = sqrtf(dx * dx + dy * dy + dz * dz) + gear.OuterRadius();
+		radius = std::max(radius, reach);
+	}
+}
+
+
+bool
+GearTrain::_AddMeshedGear(int parent, float moduleSize)
+{
+	const Gear& driver = fGears[parent];
+	if (driver.fInternal)
+		return false;
+
+	Gear gear(random_teeth(3, 12) * 2 + 1, moduleSize);
+	float angle = (rand() % 360) * M_PI / 180.0f;
+	float distance = driver.Radius() + gear.Radius() + moduleSize;
+	gear.x = driver.x + distance * cosf(angle);
+	gear.y = driver.y + distance * sinf(angle);
+	gear.z = driver.z;
+	gear.fLayer = driver.fLayer;
+
+	// The parent is the only gear allowed to reach into the new one
+	if (!fIndex.IsFree(gear.x, gear.y, gear.OuterRadius() + moduleSize / 2,
+			gear.fLayer, parent))
+		return false;
+
+	_SetRandomColor(gear);
+	int id = AddGear(gear);
+	AddLink(parent, id, GEAR_LINK_EXTERNAL);
+	_Register(id);
+	return true;
+}
+
+
+bool
+GearTrain::_AddCompoundGear(int parent, float moduleSize)
+{
+	int layer;
+	if (fGears[parent].fInternal || !_PickLayer(parent, layer))
+		return false;
+
+	Gear gear(random_teeth(3, 12) * 2 + 1, moduleSize);
+	gear.x = fGears[parent].x;
+	gear.y = fGears[parent].y;
+	gear.z = layer * fLayerSpacing;
+	gear.fLayer = layer;
+
+	if (!fIndex.IsFree(gear.x, gear.y, gear.OuterRadius() + moduleSize / 2,
+			layer))
+		return false;
+
+	_SetRandomColor(gear);
+	int id = AddGear(gear);
+	AddLink(parent, id, GEAR_LINK_AXLE);
+	_Register(id);
+	return true;
+}
+
+
+bool
+GearTrain::_AddPlanetarySet(int parent, float moduleSize)
+{
+	int layer;
+	if (fGears[parent].fInternal || !_PickLayer(parent, layer))
+		return false;
+
+	Gear sun(random_teeth(7, 15), moduleSize);
+	Gear planet(random_teeth(7, 13), moduleSize);
+	float distance = sun.Radius() + planet.Radius() + moduleSize;
+
+	// Evenly spaced planets only mesh with both sun and ring if the sum of
+	// sun and ring teeth is a multiple of the planet count.
+	int sumTeeth = 2 * (sun.fTeeth + planet.fTeeth);
+	int planets = 0;
+	for (int candidate = 5; candidate >= 3; candidate--) {
+		float gap = 2 * distance * sinf(M_PI / candidate);
+		if (sumTeeth % candidate == 0
+			&& gap > 2 * planet.TipRadius() + moduleSize / 2) {
+			planets = candidate;
+			break;
+		}
+	}
+	if (planets == 0)
+		return false;
+
+	Gear ring(sun.fTeeth + 2 * planet.fTeeth, moduleSize, true);
+	ring.fThickness = std::max(sun.fThickness, planet.fThickness);
+	ring.x = sun.x = fGears[parent].x;
+	ring.y = sun.y = fGears[parent].y;
+	ring.z = sun.z = planet.z = layer * fLayerSpacing;
+	ring.fLayer = sun.fLayer = planet.fLayer = layer;
+
+	if (!fIndex.IsFree(ring.x, ring.y, ring.OuterRadius() + moduleSize / 2,
+			layer))
+		return false;
+
+	_SetRandomColor(sun);
+	int sunId = AddGear(sun);
+	AddLink(parent, sunId, GEAR_LINK_AXLE);
+
+	_SetRandomColor(ring);
+	_SetRandomColor(planet);
+	int ringId = AddGear(ring);
+
+	float startAngle = (rand() % 360) * M_PI / 180.0f;
+	for (int i = 0; i < planets; i++) {
+		float angle = startAngle + 2 * M_PI * i / planets;
+		planet.x = sun.x + distance * cosf(angle);
+		planet.y = sun.y + distance * sinf(angle);
+		int planetId = AddGear(planet);
+		AddLink(sunId, planetId, GEAR_LINK_EXTERNAL);
+		AddLink(planetId, ringId, GEAR_LINK_INTERNAL);
+	}
+
+	// The ring's rim encloses the whole set
+	_Register(ringId);
+	return true;
+}
+
+
+bool
+GearTrain::_PickLayer(int parent, int& layer) const
+{
+	int step = rand() % 2 == 0 ? 1 : -1;
+	layer = fGears[parent].fLayer + step;
+	if (layer < 0 || layer >= kLayerCount)
+		layer = fGears[parent].fLayer - step;
+	return layer >= 0 && layer < kLayerCount;
+}
+
+
+void
+GearTrain::_Register(int id)
+{
+	const Gear& gear = fGears[id];
+	fIndex.Insert(id, gear.x, gear.y, gear.OuterRadius(), gear.fLayer);
+}
+
+
+void
+GearTrain::_SetRandomColor(Gear& gear) const
+{
+	gear.fR = 0.15f + (rand() % 75) / 75.0f;
+	gear.fG = 0.15f + (rand() % 75) / 75.0f;
+	gear.fB = 0.15f + (rand() % 75) / 75.0f;
+}
+
+
+void
+GearTrain::_Propagate(const Gear& known, Gear& unknown,
+	GearLinkType type) const
+{
+	// Meshing gears pass teeth at the same rate; gears on one axle turn
+	// by the same angle.
+	switch (type) {
+		case GEAR_LINK_EXTERNAL:
+			unknown.fToothScale = known.fToothScale;
+			unknown.fDirection = -known.fDirection;
+			break;
+		case GEAR_LINK_INTERNAL:
+			unknown.fToothScale = known.fToothScale;
+			unknown.fDirection = known.fDirection;
+			break;
+		case GEAR_LINK_AXLE:
+		default:
+			unknown.fToothScale = known.fToothScale * unknown.fTeeth
+				/ known.fTeeth;
+			unknown.fDirection = known.fDirection;
+			break;
+	}
+	unknown.fPhase = _LinkedPhase(known, unknown, type);
+}
+
+
+double
+GearTrain::_LinkedPhase(const Gear& known, const Gear& unknown,
+	GearLinkType type) const
+{
+	switch (type) {
+		case GEAR_LINK_EXTERNAL:
+		{
+			// A tooth of one gear sits in a gap of the other
+			double direction = direction_to(known, unknown);
+			return direction + 180.0 - 360.0
+				* (1.0 - tooth_phase(known, direction)) / unknown.fTeeth;
+		}
+		case GEAR_LINK_INTERNAL:
+			if (known.fInternal) {
+				double direction = direction_to(known, unknown);
+				return direction - 360.0 * tooth_phase(known, direction)
+					/ unknown.fTeeth;
+			} else {
+				double direction = direction_to(unknown, known);
+				return direction - 360.0
+					* (tooth_phase(known, direction) + 1.0) / unknown.fTeeth;
+			}
+		case GEAR_LINK_AXLE:
+		default:
+			return known.fPhase;
+	}
+}
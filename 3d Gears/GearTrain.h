@@ -0,0 +1,161 @@
+/*
+ * GearTrain.h
+ *
+ * Gear-train model for the 3D Gears screen saver: a graph of meshing gears
+ * (external pairs, compound gears on a shared axle and planetary sets), a
+ * solver that propagates angular velocity and tooth phase from the driving
+ * gear, and a procedural layout that places gears without overlaps.
+ *
+ * Rotation is a function of elapsed time, not of the number of frames:
+ * meshing gears pass teeth at the same rate, so every gear derives its angle
+ * from the tooth travel of the driver in double precision. Meshed pairs then
+ * stay exactly in phase however long the saver runs and however many frames
+ * are dropped.
+ *
+ * This file has no Haiku or OpenGL dependencies.
+ */
+
+#ifndef GEAR_TRAIN_H
+#define GEAR_TRAIN_H
+
+#include <unordered_map>
+#include <vector>
+
+enum GearLinkType {
+	GEAR_LINK_EXTERNAL,		// two external gears meshing, opposite rotation
+	GEAR_LINK_INTERNAL,		// planet meshing inside a ring gear
+	GEAR_LINK_AXLE			// compound gears sharing one axle
+};
+
+class Gear {
+public:
+								Gear(int teeth, float moduleSize,
+									bool internal = false);
+
+			float				Radius() const { return fRadius; }
+			float				ToothHeight() const { return fModuleSize; }
+			int					TeethCount() const { return fTeeth; }
+			float				Rotation() const { return fRotation; }
+
+			// Tooth tips and roots; for a ring gear the teeth point
+			// inwards, so its roots lie outside of its tips.
+			float				TipRadius() const
+									{ return fRadius + fModuleSize; }
+			float				RootRadius() const;
+			// Radius of the circle the gear occupies in its layer.
+			float				OuterRadius() const;
+			// Radius of the sphere around (x, y, z) enclosing the gear.
+			float				BoundingRadius() const;
+
+			// Sets the rotation for the given number of teeth the driver
+			// has turned by.
+			void				Update(double driverTeeth);
+
+			float				x;
+			float				y;
+			float				z;
+
+			int					fTeeth;
+			float				fModuleSize;
+			float				fRadius;
+			float				fThickness;
+			bool				fInternal;
+			int					fLayer;
+			float				fR;
+			float				fG;
+			float				fB;
+			double				fPhase;
+			// Teeth this gear passes per driver tooth, and its sense of
+			// rotation relative to the driver
+			double				fToothScale;
+			int					fDirection;
+			float				fRotation;
+};
+
+struct GearLink {
+			int					a;
+			int					b;
+			GearLinkType		type;
+};
+
+// Uniform 2D grid over the gear plane, one set of cells per layer. Each
+// gear is registered in every cell its bounding circle touches, so an
+// overlap test only looks at the few gears around the candidate position.
+class GearSpatialIndex {
+public:
+								GearSpatialIndex(float cellSize = 1.0f);
+
+			void				Clear(float cellSize);
+			void				Insert(int id, float x, float y, float radius,
+									int layer);
+			bool				IsFree(float x, float y, float radius,
+									int layer, int ignore = -1) const;
+
+private:
+	struct Entry {
+			int					id;
+			float				x;
+			float				y;
+			float				radius;
+	};
+
+			long long			_Key(int cellX, int cellY, int layer) const;
+			int					_Cell(float coordinate) const;
+
+			float				fCellSize;
+			std::unordered_map<long long, std::vector<Entry> > fCells;
+};
+
+class GearTrain {
+public:
+								GearTrain();
+
+			void				Clear();
+			int					AddGear(const Gear& gear);
+			void				AddLink(int a, int b, GearLinkType type);
+
+			// Lays out up to gearCount gears procedurally and links them.
+			// Gear 0 is the driver. Returns the number of gears placed.
+			int					Build(int gearCount, float moduleSize);
+
+			// Propagates speed and phase from the driver, which turns by
+			// toothRate teeth per second, through the link graph. Returns
+			// false if a closed loop of links is not consistent in speed or
+			// tooth phase.
+			bool				Solve(int driver, double toothRate);
+
+			void				Update(double seconds);
+
+			int					CountGears() const
+									{ return (int)fGears.size(); }
+			Gear&				GearAt(int index) { return fGears[index]; }
+			const Gear&			GearAt(int index) const
+									{ return fGears[index]; }
+
+			void				GetBounds(float& centerX, float& centerY,
+									float& centerZ, float& radius) const;
+
+	static	const int			kLayerCount = 3;
+
+private:
+			bool				_AddMeshedGear(int parent, float moduleSize);
+			bool				_AddCompoundGear(int parent, float moduleSize);
+			bool				_AddPlanetarySet(int parent, float moduleSize);
+			bool				_PickLayer(int parent, int& layer) const;
+			void				_Register(int id);
+			void				_SetRandomColor(Gear& gear) const;
+
+			void				_Propagate(const Gear& known, Gear& unknown,
+									GearLinkType type) const;
+			double				_LinkedPhase(const Gear& known,
+									const Gear& unknown,
+									GearLinkType type) const;
+
+			std::vector<Gear>	fGears;
+			std::vector<GearLink> fLinks;
+			GearSpatialIndex	fIndex;
+			float				fLayerSpacing;
+			double				fToothRate;
+};
+
+#endif // GEAR_TRAIN_H
@@ -0,0 +1,189 @@
+/*
+ * RenderScaler.cpp
+ *
+ * Offscreen render-scale path for the 3D Gears screen saver.
+ */
+
+#define GL_GLEXT_PROTOTYPES 1
+
+#include "RenderScaler.h"
+
+#include <GL/glext.h>
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "GearRenderer.h"
+
+
+const float RenderScaler::kMinScale = 0.25f;
+
+// Scale changes in steps of 5% so that the framebuffer is not reallocated
+// for every small fluctuation of the frame time.
+static const float kScaleStep = 0.05f;
+static const int kAdjustInterval = 15;
+
+
+RenderScaler::RenderScaler()
+	:
+	fAvailable(false),
+	fFramebuffer(0),
+	fColorBuffer(0),
+	fDepthBuffer(0),
+	fTargetFramebuffer(0),
+	fViewWidth(1),
+	fViewHeight(1),
+	fWidth(0),
+	fHeight(0),
+	fScale(1.0f),
+	fMaxScale(1.0f),
+	fAdaptive(false),
+	fFrameBudget(16.0),
+	fAverageFrameTime(0),
+	fSamples(0)
+{
+}
+
+
+void
+RenderScaler::Init()
+{
+	// Framebuffer objects and blits are core since GL 3.0
+	fAvailable = GearRenderer::GLVersionAtLeast(3, 0);
+	if (!fAvailable)
+		return;
+
+	glGenFramebuffers(1, &fFramebuffer);
+	glGenRenderbuffers(1, &fColorBuffer);
+	glGenRenderbuffers(1, &fDepthBuffer);
+	fWidth = fHeight = 0;
+}
+
+
+void
+RenderScaler::Release()
+{
+	if (fFramebuffer != 0)
+		glDeleteFramebuffers(1, &fFramebuffer);
+	if (fColorBuffer != 0)
+		glDeleteRenderbuffers(1, &fColorBuffer);
+	if (fDepthBuffer != 0)
+		glDeleteRenderbuffers(1, &fDepthBuffer);
+	fFramebuffer = fColorBuffer = fDepthBuffer = 0;
+	fAvailable = false;
+}
+
+
+void
+RenderScaler::SetViewSize(int width, int height)
+{
+	fViewWidth = std::max(1, width);
+	fViewHeight = std::max(1, height);
+}
+
+
+void
+RenderScaler::SetMaxScale(float scale)
+{
+	fMaxScale = std::max(kMinScale, std::min(1.0f, scale));
+	if (!fAdaptive || fScale > fMaxScale)
+		fScale = fMaxScale;
+}
+
+
+void
+RenderScaler::SetAdaptive(bool adaptive, double frameBudget)
+{
+	if (fAdaptive != adaptive) {
+		fAverageFrameTime = 0;
+		fSamples = 0;
+	}
+	fAdaptive = adaptive;
+	fFrameBudget = frameBudget;
+	if (!fAdaptive)
+		fScale = fMaxScale;
+}
+
+
+bool
+RenderScaler::Begin()
+{
+	if (!fAvailable || fScale >= 1.0f)
+		return false;
+
+	int width = std::max(1, (int)(fViewWidth * fScale + 0.5f));
+	int height = std::max(1, (int)(fViewHeight * fScale + 0.5f));
+	if ((width != fWidth || height != fHeight) && !_Allocate(width, height)) {
+		fAvailable = false;
+		return false;
+	}
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &fTargetFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, fFramebuffer);
+	glViewport(0, 0, fWidth, fHeight);
+	return true;
+}
+
+
+void
+RenderScaler::End()
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fTargetFramebuffer);
+	glBlitFramebuffer(0, 0, fWidth, fHeight, 0, 0, fViewWidth, fViewHeight,
+		GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, fTargetFramebuffer);
+	glViewport(0, 0, fViewWidth, fViewHeight);
+}
+
+
+void
+RenderScaler::AddFrameTime(double frameTime)
+{
+	if (!fAdaptive)
+		return;
+
+	fAverageFrameTime = fAverageFrameTime == 0
+		? frameTime : fAverageFrameTime * 0.9 + frameTime * 0.1;
+	if (++fSamples < kAdjustInterval)
+		return;
+	fSamples = 0;
+
+	float scale = fScale;
+	if (fAverageFrameTime > fFrameBudget) {
+		// Fill cost grows with the square of the scale
+		scale *= std::max(0.7, sqrt(fFrameBudget / fAverageFrameTime));
+		scale = std::min(fScale - kScaleStep,
+			floorf(scale / kScaleStep) * kScaleStep);
+	} else if (fAverageFrameTime < 0.7 * fFrameBudget)
+		scale += kScaleStep;
+
+	fScale = std::max(kMinScale, std::min(fMaxScale, scale));
+}
+
+
+bool
+RenderScaler::_Allocate(int width, int height)
+{
+	glBindRenderbuffer(GL_RENDERBUFFER, fColorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, fDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+		height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLint previous;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	glBindFramebuffer(GL_FRAMEBUFFER, fFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, fColorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, fDepthBuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+	fWidth = width;
+	fHeight = height;
+	return status == GL_FRAMEBUFFER_COMPLETE;
+}
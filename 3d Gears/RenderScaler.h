@@ -0,0 +1,68 @@
+/*
+ * RenderScaler.h
+ *
+ * Renders a frame into an offscreen framebuffer at a fraction of the view
+ * size and upscales it into the view with a filtered blit. The fraction can
+ * follow the measured frame time, trading sharpness for frame rate when the
+ * scene is fill-rate bound, as it is on software GL at high resolutions.
+ *
+ * This file has no Haiku dependencies; a current GL context is expected.
+ */
+
+#ifndef RENDER_SCALER_H
+#define RENDER_SCALER_H
+
+#include <GL/gl.h>
+
+class RenderScaler {
+public:
+								RenderScaler();
+
+			// Both need the GL context to be current.
+			void				Init();
+			void				Release();
+
+			void				SetViewSize(int width, int height);
+			// Upper bound of the render scale; without adaptive scaling
+			// it is used as is.
+			void				SetMaxScale(float scale);
+			void				SetAdaptive(bool adaptive,
+									double frameBudget);
+
+			float				Scale() const { return fScale; }
+
+			// Begin() redirects rendering to the offscreen framebuffer and
+			// returns true, or returns false if the frame should be drawn
+			// directly. End() upscales the result into the framebuffer that
+			// was bound before Begin().
+			bool				Begin();
+			void				End();
+
+			// Feeds the adaptive controller, in milliseconds
+			void				AddFrameTime(double frameTime);
+
+	static	const float			kMinScale;
+
+private:
+			bool				_Allocate(int width, int height);
+
+			bool				fAvailable;
+			GLuint				fFramebuffer;
+			GLuint				fColorBuffer;
+			GLuint				fDepthBuffer;
+			GLint				fTargetFramebuffer;
+
+			int					fViewWidth;
+			int					fViewHeight;
+			int					fWidth;
+			int					fHeight;
+
+			float				fScale;
+			float				fMaxScale;
+			bool				fAdaptive;
+			double				fFrameBudget;
+			double				fAverageFrameTime;
+			int					fSamples;
+};
+
+#endif // RENDER_SCALER_H
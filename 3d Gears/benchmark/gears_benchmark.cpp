@@ -0,0 +1,398 @@
+/*
+ * gears_benchmark.cpp
+ *
+ * Headless benchmark for the 3D Gears scene on Linux. Creates an offscreen
+ * Mesa context through EGL surfaceless, renders a fixed number of frames at
+ * a fixed time step into a framebuffer object, and reports the frame rate,
+ * the CPU time per frame and a checksum of the last frame. With the same
+ * seed, size and driver the checksum is stable, so it can be used as a
+ * regression gate for mesh and renderer changes.
+ *
+ * Before rendering it checks that the solver rejects a train that would
+ * jam, and that such a train is left standing still.
+ *
+ * Usage: gears_benchmark [-f frames] [-s WIDTHxHEIGHT] [-g gears]
+ *            [-S seed] [-r render_scale] [-o image.ppm]
+ */
+
+#define GL_GLEXT_PROTOTYPES 1
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "GearScene.h"
+
+
+// Animation time step, matching the 20 ms tick of the screen saver
+static const double kTimeStep = 0.02;
+
+// Driver speed of a baseSpeed of 1 in the screen saver, in teeth per second
+static const double kToothRate = 20.0 / 360.0 * 50.0;
+
+
+class HeadlessContext : public GearContext {
+public:
+								HeadlessContext();
+	virtual						~HeadlessContext();
+
+			bool				Init(int width, int height);
+			bool				ReadPixels(std::vector<uint8_t>& pixels);
+
+	virtual	void				LockContext();
+	virtual	void				UnlockContext();
+	virtual	void				SwapContext();
+
+private:
+			EGLDisplay			fDisplay;
+			EGLContext			fContext;
+			GLuint				fFramebuffer;
+			GLuint				fRenderbuffers[2];
+			int					fWidth;
+			int					fHeight;
+};
+
+
+HeadlessContext::HeadlessContext()
+	:
+	fDisplay(EGL_NO_DISPLAY),
+	fContext(EGL_NO_CONTEXT),
+	fFramebuffer(0),
+	fWidth(0),
+	fHeight(0)
+{
+	fRenderbuffers[0] = fRenderbuffers[1] = 0;
+}
+
+
+HeadlessContext::~HeadlessContext()
+{
+	if (fContext != EGL_NO_CONTEXT) {
+		LockContext();
+		glDeleteFramebuffers(1, &fFramebuffer);
+		glDeleteRenderbuffers(2, fRenderbuffers);
+		UnlockContext();
+		eglDestroyContext(fDisplay, fContext);
+	}
+	if (fDisplay != EGL_NO_DISPLAY)
+		eglTerminate(fDisplay);
+}
+
+
+bool
+HeadlessContext::Init(int width, int height)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay
+		= (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+			"eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL) {
+		fDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+			EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (fDisplay == EGL_NO_DISPLAY)
+		fDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (fDisplay == EGL_NO_DISPLAY || !eglInitialize(fDisplay, &major, &minor)) {
+		fprintf(stderr, "Could not initialize EGL\n");
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL has no desktop OpenGL support\n");
+		return false;
+	}
+
+	// The scene uses the fixed-function pipeline, so ask for a 3.3
+	// compatibility profile and settle for whatever the driver offers
+	// otherwise; the renderer then takes its batched path.
+	const EGLint attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK,
+			EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+	fContext = eglCreateContext(fDisplay, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+		attributes);
+	if (fContext == EGL_NO_CONTEXT) {
+		fContext = eglCreateContext(fDisplay, EGL_NO_CONFIG_KHR,
+			EGL_NO_CONTEXT, NULL);
+	}
+	if (fContext == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Could not create an OpenGL context (0x%x)\n",
+			eglGetError());
+		return false;
+	}
+
+	LockContext();
+	if (!GearRenderer::GLVersionAtLeast(3, 0)) {
+		fprintf(stderr, "Framebuffer objects need OpenGL 3.0, got %s\n",
+			glGetString(GL_VERSION));
+		return false;
+	}
+
+	fWidth = width;
+	fHeight = height;
+	glGenRenderbuffers(2, fRenderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, fRenderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, fRenderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+		height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &fFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, fFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, fRenderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, fRenderbuffers[1]);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Incomplete framebuffer\n");
+		return false;
+	}
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+
+bool
+HeadlessContext::ReadPixels(std::vector<uint8_t>& pixels)
+{
+	pixels.resize((size_t)fWidth * fHeight * 4);
+	LockContext();
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fFramebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, fWidth, fHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+		&pixels[0]);
+	bool ok = glGetError() == GL_NO_ERROR;
+	UnlockContext();
+	return ok;
+}
+
+
+void
+HeadlessContext::LockContext()
+{
+	eglMakeCurrent(fDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, fContext);
+}
+
+
+void
+HeadlessContext::UnlockContext()
+{
+	// The context stays current; the benchmark only has one thread
+}
+
+
+void
+HeadlessContext::SwapContext()
+{
+	// There is nothing to present; wait for the frame like a swap would
+	glFinish();
+}
+
+
+// #pragma mark -
+
+
+static double
+elapsed_ms(clockid_t clock, const timespec& start)
+{
+	timespec now;
+	clock_gettime(clock, &now);
+	return (now.tv_sec - start.tv_sec) * 1000.0
+		+ (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+
+static uint64_t
+fnv1a_checksum(const std::vector<uint8_t>& data)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < data.size(); i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+// Three external gears meshing in a triangle: each pair turns in opposite
+// directions, so the loop cannot turn at all.
+static bool
+check_jammed_train()
+{
+	GearTrain train;
+	for (int i = 0; i < 3; i++) {
+		Gear gear(12, 0.075f);
+		gear.x = 0.45f * cosf(i * 2 * M_PI / 3);
+		gear.y = 0.45f * sinf(i * 2 * M_PI / 3);
+		train.AddGear(gear);
+	}
+	train.AddLink(0, 1, GEAR_LINK_EXTERNAL);
+	train.AddLink(1, 2, GEAR_LINK_EXTERNAL);
+	train.AddLink(2, 0, GEAR_LINK_EXTERNAL);
+
+	if (train.Solve(0, kToothRate)) {
+		fprintf(stderr, "Solver accepted a jammed train\n");
+		return false;
+	}
+
+	// What GearScene::Build() falls back to
+	train.Solve(0, 0.0);
+	float rotations[3];
+	for (int i = 0; i < 3; i++)
+		rotations[i] = train.GearAt(i).Rotation();
+	train.Update(100.0);
+	for (int i = 0; i < 3; i++) {
+		if (train.GearAt(i).Rotation() != rotations[i]) {
+			fprintf(stderr, "Jammed train does not stand still\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static bool
+write_ppm(const char* path, const std::vector<uint8_t>& pixels, int width,
+	int height)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	// GL rows start at the bottom
+	for (int y = height - 1; y >= 0; y--) {
+		const uint8_t* row = &pixels[(size_t)y * width * 4];
+		for (int x = 0; x < width; x++)
+			fwrite(row + x * 4, 1, 3, file);
+	}
+	return fclose(file) == 0;
+}
+
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-f frames] [-s WIDTHxHEIGHT] [-g gears] "
+		"[-S seed] [-r render_scale] [-o image.ppm]\n", name);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	int frames = 300;
+	int width = 1280;
+	int height = 720;
+	int gearCount = 24;
+	unsigned seed = 1;
+	float renderScale = 1.0f;
+	const char* imagePath = NULL;
+
+	int option;
+	while ((option = getopt(argc, argv, "f:s:g:S:r:o:h")) != -1) {
+		switch (option) {
+			case 'f':
+				frames = atoi(optarg);
+				break;
+			case 's':
+				if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'g':
+				gearCount = atoi(optarg);
+				break;
+			case 'S':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'r':
+				renderScale = atof(optarg);
+				break;
+			case 'o':
+				imagePath = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (frames < 1 || width < 1 || height < 1 || gearCount < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!check_jammed_train())
+		return 1;
+
+	HeadlessContext context;
+	if (!context.Init(width, height))
+		return 1;
+
+	srand(seed);
+	GearScene scene;
+	bool solved = scene.Build(gearCount, kToothRate);
+	scene.InitGL(width, height);
+	scene.Scaler().SetMaxScale(renderScale);
+
+	printf("renderer: %s, %s\n", glGetString(GL_RENDERER),
+		glGetString(GL_VERSION));
+	printf("scene: %d gears, %dx%d, %s path, %d%% render scale\n",
+		scene.Train().CountGears(), width, height,
+		scene.Renderer().PathName(),
+		(int)(scene.Scaler().Scale() * 100 + 0.5f));
+	if (!solved)
+		printf("train: no consistent layout, standing still\n");
+
+	timespec wallStart, cpuStart;
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+
+	long drawnGears = 0;
+	for (int frame = 0; frame < frames; frame++) {
+		scene.DrawFrame(context, frame * kTimeStep);
+		drawnGears += scene.Renderer().CountDrawnGears();
+	}
+
+	// CPU time covers all threads of the process, including the worker
+	// threads of software rasterizers
+	double wallTime = elapsed_ms(CLOCK_MONOTONIC, wallStart);
+	double cpuTime = elapsed_ms(CLOCK_PROCESS_CPUTIME_ID, cpuStart);
+
+	std::vector<uint8_t> pixels;
+	if (!context.ReadPixels(pixels)) {
+		fprintf(stderr, "Could not read back the last frame\n");
+		return 1;
+	}
+
+	printf("frames: %d in %.1f ms\n", frames, wallTime);
+	printf("frames/s: %.2f\n", frames * 1000.0 / wallTime);
+	printf("wall time/frame: %.3f ms\n", wallTime / frames);
+	printf("CPU time/frame: %.3f ms\n", cpuTime / frames);
+	printf("gears drawn/frame: %.1f of %d\n", (double)drawnGears / frames,
+		scene.Train().CountGears());
+	printf("checksum: %016llx\n", (unsigned long long)fnv1a_checksum(pixels));
+
+	if (imagePath != NULL && !write_ppm(imagePath, pixels, width, height)) {
+		fprintf(stderr, "Could not write %s\n", imagePath);
+		return 1;
+	}
+
+	scene.ReleaseGL();
+	return 0;
+}
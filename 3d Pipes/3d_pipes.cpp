@@ -12,6 +12,8 @@
  * The code was generated based on the user's requirements and best practices for Haiku OS development.
  */
 
+#define GL_GLEXT_PROTOTYPES 1
+
 #include <ScreenSaver.h>
 #include <LayoutBuilder.h>
 #include <GridLayoutBuilder.h>
@@ -21,23 +23,78 @@
 #include <TextView.h>
 #include <ScrollView.h>
 #include <Slider.h>
+#include <Button.h>
+#include <CheckBox.h>
 #include <GLView.h>
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <GL/glu.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <syslog.h>
 #include <time.h>
+#include <algorithm>
+#include <unordered_map>
 #include <vector>
 
-const int GRID_SIZE = 20;
+#include "PipeGrowth.h"
+
+// Volumes up to the default size are watched from outside; the camera flies
+// through larger ones
+const int kDefaultVolumeSize = 20;
+const int kVolumeSizes[] = { 20, 32, 64, 128, 256, 512, 1024 };
+const int kVolumeSizeCount = sizeof(kVolumeSizes) / sizeof(kVolumeSizes[0]);
+
+const int kMaxPipeCount = 2000;
+
+// When flying, the distance in cells the camera sees and its speed in cells
+// per tick
+const float kViewDistance = 48.0f;
+const float kCameraSpeed = 0.15f;
+
+// Tessellation of the pipe geometry, as previously passed to gluCylinder
+// and gluSphere, and the number of rings along an elbow
+const int kCylinderSlices = 14;
+const int kSphereSlices = 16;
+const int kSphereStacks = 16;
+const int kElbowSteps = 8;
+
+// Every cell of a pipe is drawn with one of a fixed set of meshes, placed at
+// the cell: a cylinder through the cell along each axis where the pipe runs
+// straight, an elbow for each of the 24 pairs of perpendicular directions
+// where it turns, and at both ends a half cylinder towards the rest of the
+// pipe closed by the joint sphere.
+enum {
+    kMeshCylinder = 0,
+    kMeshHalfCylinder = kMeshCylinder + 3,
+    kMeshSphere = kMeshHalfCylinder + 6,
+    kMeshElbow,
+    kMeshCount = kMeshElbow + 24
+};
 
 struct Point3D {
     float x, y, z;
 };
 
-struct Pipe {
-    std::vector<Point3D> segments;
+struct PipeVertex {
+    float x, y, z;
+    float nx, ny, nz;
+};
+
+// A mesh placed at a cell since the last frame, in the color of its pipe at
+// the time
+struct PipePiece {
+    int mesh;
+    PipeCell cell;
+    float r, g, b;
+};
+
+// Per-instance data of a mesh
+struct PipeInstance {
+    float x, y, z;
     float r, g, b;
-    int direction;
 };
 
 class PipesScreenSaver;
@@ -53,10 +110,20 @@ private:
     BStringView* fNameStringView;
     BSlider* fPipeCountSlider;
     BSlider* fPipeRadiusSlider;
+    BSlider* fVolumeSizeSlider;
+    BCheckBox* fAccumulateCheckBox;
+    BCheckBox* fReportCullingCheckBox;
+    BButton* fNewSceneButton;
+
+    void UpdateLabels();
 
     enum {
         kMsgPipeCountChanged = 'pccg',
-        kMsgPipeRadiusChanged = 'prcg'
+        kMsgPipeRadiusChanged = 'prcg',
+        kMsgVolumeSizeChanged = 'pvcg',
+        kMsgAccumulateChanged = 'pacg',
+        kMsgReportCullingChanged = 'prcl',
+        kMsgNewScene = 'pnsc'
     };
 };
 
@@ -64,23 +131,118 @@ class PipesGLView : public BGLView {
 public:
     PipesGLView(BRect frame);
     void AttachedToWindow() override;
+    void DetachedFromWindow() override;
     void Draw(BRect updateRect);
-    void SetParameters(int32 pipeCount, float segmentLength, float pipeRadius);
+    void SetParameters(int32 pipeCount, int32 volumeSize, float segmentLength,
+        float pipeRadius, bool accumulate, uint32 seed);
+    void SetReportCulling(bool report) { fReportCulling = report; }
+
+    // Bricks holding pipe cells in the last frame drawn in full, and how
+    // many of them were drawn
+    int CountChunks() const { return (int)fChunkVisibility.size(); }
+    int CountDrawnChunks() const { return fDrawnChunkCount; }
 
 private:
     float fWidth, fHeight;
-    std::vector<Pipe> pipes;
-    bool grid[GRID_SIZE][GRID_SIZE][GRID_SIZE];
+    PipeGrowth fGrowth;
     int32 fPipeCount;
+    int32 fVolumeSize;
     float fSegmentLength;
     float fPipeRadius;
+    uint32 fSeed;
+
+    // Meshes shared by all pipes, and the range of the stitched triangle
+    // strip of each one in fMeshIndices
+    std::vector<PipeVertex> fMeshVertices;
+    std::vector<GLushort> fMeshIndices;
+    int fMeshFirstIndex[kMeshCount];
+    int fMeshIndexCount[kMeshCount];
+    int fElbowMeshes[6][6];
+    bool fMeshesChanged;
+
+    // Instances of each mesh to draw this frame
+    std::vector<PipeInstance> fInstances[kMeshCount];
+
+    // Instanced drawing with OpenGL 3.3: the meshes are kept in buffer
+    // objects, and a shader places and lights the instances of a mesh the
+    // way the fixed-function pipeline would, all in one call
+    bool fInstancingSupported;
+    GLuint fMeshBuffers[2];
+    GLuint fInstanceBuffer;
+    GLuint fInstanceProgram;
+    GLint fFogUniform;
+    std::vector<PipeInstance> fInstanceData;
+
+    // Pipes are culled by the bricks of the volume they run through: each
+    // brick a pipe reaches is tested against the planes of the view frustum
+    // once a frame, and the cells of hidden ones are left out
+    float fFrustum[6][4];
+    std::unordered_map<uint32_t, bool> fChunkVisibility;
+    int fDrawnChunkCount;
+    // Bricks summed up over the frames since the last report, which is
+    // only logged on request
+    bool fReportCulling;
+    int fReportFrameCount;
+    int64 fChunkSum;
+    int64 fDrawnChunkSum;
+
+    // Camera, and where new pipes are started when flying
+    double fCameraTime;
+    Point3D fCameraPosition;
+    Point3D fCameraTarget;
+    Point3D fSpawnCenter;
+    bool fProjectionChanged;
+
+    // Accumulate mode: finished pipes stay on screen. The picture is kept in
+    // a framebuffer object between frames, so a frame only draws the blocks
+    // grown since the previous one instead of clearing and redrawing all.
+    bool fAccumulate;
+    bool fFramebufferSupported;
+    bool fAccumulateClearPending;
+    GLuint fAccumulateFramebuffer;
+    GLuint fAccumulateRenderbuffers[2];
+    int fAccumulateWidth, fAccumulateHeight;
+    GLint fTargetFramebuffer;
+    std::vector<PipePiece> fNewPieces;
 
     void InitPipes();
-    void AddNewPipe();
+    void BuildMeshes();
+    void AddMesh(int mesh, const std::vector<PipeVertex>& vertices, int ringVertices);
+    // Mesh of a cell the pipe enters in one direction and leaves in another
+    int CellMesh(int in, int out) const {
+        return in == out ? kMeshCylinder + in / 2 : fElbowMeshes[in][out];
+    }
+    void CellPosition(PipeCell cell, Point3D& position) const;
+    void CellCoordinates(const Point3D& position, float coordinates[3]) const;
     void UpdatePipes();
-    void DrawPipes();
-    void DrawPipeSegment(const Point3D& start, const Point3D& end);
-    void DrawJoint(const Point3D& prev, const Point3D& current, const Point3D& next);
+    void AddPieces(const PipeEvent& event);
+    void AddPiece(const PipeEvent& event, int mesh, PipeCell cell);
+    void AddInstance(const Pipe& pipe, int mesh, const Point3D& position);
+    void CollectPipes();
+    void UpdateFrustum();
+    bool ChunkVisible(uint32_t chunk);
+    void ReportChunks();
+    void CollectNewPieces();
+    void DrawInstances();
+    bool InitInstancing();
+    void UploadMeshes();
+
+    // Large volumes are flown through, unless the picture accumulates
+    bool Flying() const { return fVolumeSize > kDefaultVolumeSize && !Accumulating(); }
+    // Of the still camera, which frames the whole volume
+    float StillScale() const { return (float)fVolumeSize / kDefaultVolumeSize; }
+    void SetProjection();
+    float CameraAmplitude() const { return 0.4f * fVolumeSize * fSegmentLength; }
+    float CameraDistanceSquared(const Point3D& position) const;
+    void CameraPath(double time, Point3D& position) const;
+    void UpdateCamera();
+    void PlaceCamera();
+
+    // The persistent framebuffer only holds while the camera stands still,
+    // so accumulating keeps it still at any volume size
+    bool Accumulating() const { return fAccumulate && fFramebufferSupported; }
+    bool BeginAccumulation();
+    void EndAccumulation();
 };
 
 class PipesScreenSaver : public BScreenSaver {
@@ -95,19 +257,52 @@ public:
 
     int32 GetPipeCount() { return fPipeCount; }
     float GetPipeRadius() { return fPipeRadius; }
+    int32 GetVolumeSize() { return fVolumeSize; }
+    bool GetAccumulate() { return fAccumulate; }
+    bool GetReportCulling() { return fReportCulling; }
+    uint32 GetSeed() { return fSeed; }
 
     void SetPipeCount(int32 count);
     void SetPipeRadius(float radius);
+    void SetVolumeSize(int32 size);
+    void SetAccumulate(bool accumulate);
+    void SetReportCulling(bool report);
+    void SetSeed(uint32 seed);
 
 private:
     PipesGLView* fGLView;
     int32 fPipeCount;
+    int32 fVolumeSize;
     float fSegmentLength;
     float fPipeRadius;
+    bool fAccumulate;
+    bool fReportCulling;
+    uint32 fSeed;
 };
 
 // Implementation of PipesConfigView
 
+static uint32 NewSceneSeed() {
+    return (uint32)time(NULL) * 2654435761u;
+}
+
+// The pipe count slider is logarithmic, so that a handful of pipes is as
+// easy to pick as a few thousand
+static int32 PipeCountForSlider(int32 value) {
+    return (int32)roundf(powf(kMaxPipeCount, value / 100.0f));
+}
+
+static int32 SliderForPipeCount(int32 count) {
+    return (int32)roundf(logf(std::max(count, (int32)1)) / logf(kMaxPipeCount) * 100.0f);
+}
+
+static int32 SliderForVolumeSize(int32 size) {
+    int32 index = 0;
+    while (index < kVolumeSizeCount - 1 && kVolumeSizes[index] < size)
+        index++;
+    return index;
+}
+
 PipesConfigView::PipesConfigView(BRect frame, PipesScreenSaver* saver)
     : BView(frame, "PipesConfigView", B_FOLLOW_ALL_SIDES, B_WILL_DRAW),
       fSaver(saver) {
@@ -122,11 +317,11 @@ PipesConfigView::PipesConfigView(BRect frame, PipesScreenSaver* saver)
     layout->AddView(fNameStringView);
 
     fPipeCountSlider = new BSlider("pipeCount", "Number of Pipes:", 
-        new BMessage(kMsgPipeCountChanged), 1, 20, B_HORIZONTAL);
-    fPipeCountSlider->SetValue(fSaver->GetPipeCount());
+        new BMessage(kMsgPipeCountChanged), 0, 100, B_HORIZONTAL);
+    fPipeCountSlider->SetValue(SliderForPipeCount(fSaver->GetPipeCount()));
     fPipeCountSlider->SetHashMarks(B_HASH_MARKS_BOTTOM);
-    fPipeCountSlider->SetHashMarkCount(20);
-    fPipeCountSlider->SetLimitLabels("1", "20");
+    fPipeCountSlider->SetHashMarkCount(11);
+    fPipeCountSlider->SetLimitLabels("1", "2000");
     layout->AddView(fPipeCountSlider);
 
     fPipeRadiusSlider = new BSlider("pipeRadius", "Pipe Radius:", 
@@ -137,6 +332,30 @@ PipesConfigView::PipesConfigView(BRect frame, PipesScreenSaver* saver)
     fPipeRadiusSlider->SetLimitLabels("Min", "Max");
     layout->AddView(fPipeRadiusSlider);
 
+    fVolumeSizeSlider = new BSlider("volumeSize", "Volume Size:",
+        new BMessage(kMsgVolumeSizeChanged), 0, kVolumeSizeCount - 1, B_HORIZONTAL);
+    fVolumeSizeSlider->SetValue(SliderForVolumeSize(fSaver->GetVolumeSize()));
+    fVolumeSizeSlider->SetHashMarks(B_HASH_MARKS_BOTTOM);
+    fVolumeSizeSlider->SetHashMarkCount(kVolumeSizeCount);
+    fVolumeSizeSlider->SetLimitLabels("20", "1024");
+    layout->AddView(fVolumeSizeSlider);
+    UpdateLabels();
+
+    fAccumulateCheckBox = new BCheckBox("accumulate", "Keep finished pipes on screen",
+        new BMessage(kMsgAccumulateChanged));
+    fAccumulateCheckBox->SetValue(fSaver->GetAccumulate() ? B_CONTROL_ON : B_CONTROL_OFF);
+    layout->AddView(fAccumulateCheckBox);
+
+    fReportCullingCheckBox = new BCheckBox("reportCulling",
+        "Log culled volume bricks to syslog", new BMessage(kMsgReportCullingChanged));
+    fReportCullingCheckBox->SetValue(fSaver->GetReportCulling() ? B_CONTROL_ON : B_CONTROL_OFF);
+    layout->AddView(fReportCullingCheckBox);
+
+    // The scene replays from its seed every time the saver starts, until a
+    // new one is picked here
+    fNewSceneButton = new BButton("newScene", "New Scene", new BMessage(kMsgNewScene));
+    layout->AddView(fNewSceneButton);
+
     BTextView* infoTextView = new BTextView(frame, "infoTextView", frame, B_FOLLOW_ALL_SIDES);
     infoTextView->SetViewColor(ui_color(B_PANEL_BACKGROUND_COLOR));
     infoTextView->MakeEditable(false);
@@ -154,16 +373,44 @@ PipesConfigView::PipesConfigView(BRect frame, PipesScreenSaver* saver)
 void PipesConfigView::AttachedToWindow() {
     fPipeCountSlider->SetTarget(this);
     fPipeRadiusSlider->SetTarget(this);
+    fVolumeSizeSlider->SetTarget(this);
+    fAccumulateCheckBox->SetTarget(this);
+    fReportCullingCheckBox->SetTarget(this);
+    fNewSceneButton->SetTarget(this);
+}
+
+void PipesConfigView::UpdateLabels() {
+    char label[64];
+    snprintf(label, sizeof(label), "Number of Pipes: %d",
+        (int)PipeCountForSlider(fPipeCountSlider->Value()));
+    fPipeCountSlider->SetLabel(label);
+    int size = kVolumeSizes[fVolumeSizeSlider->Value()];
+    snprintf(label, sizeof(label), "Volume Size: %d×%d×%d", size, size, size);
+    fVolumeSizeSlider->SetLabel(label);
 }
 
 void PipesConfigView::MessageReceived(BMessage* message) {
     switch (message->what) {
         case kMsgPipeCountChanged:
-            fSaver->SetPipeCount(fPipeCountSlider->Value());
+            fSaver->SetPipeCount(PipeCountForSlider(fPipeCountSlider->Value()));
+            UpdateLabels();
             break;
         case kMsgPipeRadiusChanged:
             fSaver->SetPipeRadius(fPipeRadiusSlider->Value() / 100.0f);
             break;
+        case kMsgVolumeSizeChanged:
+            fSaver->SetVolumeSize(kVolumeSizes[fVolumeSizeSlider->Value()]);
+            UpdateLabels();
+            break;
+        case kMsgAccumulateChanged:
+            fSaver->SetAccumulate(fAccumulateCheckBox->Value() == B_CONTROL_ON);
+            break;
+        case kMsgReportCullingChanged:
+            fSaver->SetReportCulling(fReportCullingCheckBox->Value() == B_CONTROL_ON);
+            break;
+        case kMsgNewScene:
+            fSaver->SetSeed(NewSceneSeed());
+            break;
         default:
             BView::MessageReceived(message);
     }
@@ -171,11 +418,106 @@ void PipesConfigView::MessageReceived(BMessage* message) {
 
 // Implementation of PipesGLView
 
+static bool GLVersionAtLeast(int major, int minor) {
+    const char* version = (const char*)glGetString(GL_VERSION);
+    int versionMajor = 0, versionMinor = 0;
+    if (version == nullptr || sscanf(version, "%d.%d", &versionMajor, &versionMinor) != 2)
+        return false;
+    return versionMajor > major || (versionMajor == major && versionMinor >= minor);
+}
+
+// Generic vertex attributes of the instancing shader; 0 aliases gl_Vertex
+const GLuint kOffsetAttribute = 1;
+const GLuint kColorAttribute = 2;
+
+// Moves a mesh vertex to its instance and applies the lighting of
+// AttachedToWindow(): light 0 is directional, and the color stands for
+// the ambient and diffuse material as with GL_COLOR_MATERIAL
+static const char* kInstanceVertexShader =
+    "#version 120\n"
+    "attribute vec3 offset;\n"
+    "attribute vec3 color;\n"
+    "void main() {\n"
+    "    vec4 position = gl_ModelViewMatrix * vec4(gl_Vertex.xyz + offset, 1.0);\n"
+    "    vec3 normal = normalize(gl_NormalMatrix * gl_Normal);\n"
+    "    float diffuse = max(dot(normal, normalize(gl_LightSource[0].position.xyz)), 0.0);\n"
+    "    vec3 light = gl_LightModel.ambient.rgb + gl_LightSource[0].ambient.rgb\n"
+    "        + gl_LightSource[0].diffuse.rgb * diffuse;\n"
+    "    gl_FrontColor = vec4(color * light, 1.0);\n"
+    "    gl_FogFragCoord = abs(position.z);\n"
+    "    gl_Position = gl_ProjectionMatrix * position;\n"
+    "}\n";
+
+// Linear fog, as set up in Draw()
+static const char* kInstanceFragmentShader =
+    "#version 120\n"
+    "uniform bool fog;\n"
+    "void main() {\n"
+    "    vec3 color = gl_Color.rgb;\n"
+    "    if (fog) {\n"
+    "        float visibility = clamp((gl_Fog.end - gl_FogFragCoord) * gl_Fog.scale, 0.0, 1.0);\n"
+    "        color = mix(gl_Fog.color.rgb, color, visibility);\n"
+    "    }\n"
+    "    gl_FragColor = vec4(color, 1.0);\n"
+    "}\n";
+
+static GLuint CompileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// Two unit vectors spanning the cross section of a pipe running along the
+// axis of the direction. Both directions of an axis share them, so that
+// the rings of adjoining meshes line up.
+static void CrossSection(int direction, float u[3], float v[3]) {
+    const int* axis = kDirections[direction & ~1];
+    u[0] = axis[1]; u[1] = axis[2]; u[2] = axis[0];
+    v[0] = axis[1] * u[2] - axis[2] * u[1];
+    v[1] = axis[2] * u[0] - axis[0] * u[2];
+    v[2] = axis[0] * u[1] - axis[1] * u[0];
+}
+
+// Appends a ring of the pipe's cross section around the center, in the
+// plane spanned by u and v
+static void AddRing(std::vector<PipeVertex>& vertices, const float center[3],
+        const float u[3], const float v[3], float radius) {
+    for (int i = 0; i <= kCylinderSlices; ++i) {
+        float angle = 2.0f * M_PI * i / kCylinderSlices;
+        float c = cosf(angle);
+        float s = sinf(angle);
+        PipeVertex vertex;
+        vertex.nx = c * u[0] + s * v[0];
+        vertex.ny = c * u[1] + s * v[1];
+        vertex.nz = c * u[2] + s * v[2];
+        vertex.x = center[0] + radius * vertex.nx;
+        vertex.y = center[1] + radius * vertex.ny;
+        vertex.z = center[2] + radius * vertex.nz;
+        vertices.push_back(vertex);
+    }
+}
+
 PipesGLView::PipesGLView(BRect frame)
     : BGLView(frame, "PipesGLView", B_FOLLOW_ALL, B_WILL_DRAW, BGL_RGB | BGL_DOUBLE | BGL_DEPTH),
       fWidth(frame.Width()), fHeight(frame.Height()),
-      fPipeCount(10), fSegmentLength(1.0f), fPipeRadius(0.1f) {
-    srand(time(NULL));
+      fPipeCount(10), fVolumeSize(kDefaultVolumeSize), fSegmentLength(1.0f), fPipeRadius(0.1f),
+      fSeed(0),
+      fMeshesChanged(true), fInstancingSupported(false), fInstanceBuffer(0),
+      fInstanceProgram(0), fFogUniform(-1), fDrawnChunkCount(0), fReportCulling(false),
+      fReportFrameCount(0), fChunkSum(0), fDrawnChunkSum(0),
+      fCameraTime(0.0), fProjectionChanged(true),
+      fAccumulate(false), fFramebufferSupported(false), fAccumulateClearPending(true),
+      fAccumulateFramebuffer(0), fAccumulateWidth(0), fAccumulateHeight(0),
+      fTargetFramebuffer(0) {
+    fAccumulateRenderbuffers[0] = fAccumulateRenderbuffers[1] = 0;
+    fMeshBuffers[0] = fMeshBuffers[1] = 0;
     InitPipes();
 }
 
@@ -199,233 +541,657 @@ void PipesGLView::AttachedToWindow() {
     glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
     glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0, fWidth / fHeight, 0.1, 100.0);
-    glMatrixMode(GL_MODELVIEW);
+    // Fog hides where the view ends when flying through large volumes
+    GLfloat fog_color[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    glFogi(GL_FOG_MODE, GL_LINEAR);
+    glFogfv(GL_FOG_COLOR, fog_color);
+
+    // Framebuffer objects and blits are core since OpenGL 3.0, instanced
+    // arrays since 3.3
+    fFramebufferSupported = GLVersionAtLeast(3, 0);
+    fInstancingSupported = GLVersionAtLeast(3, 3) && InitInstancing();
     UnlockGL();
+
+    // The scene built by the constructor could not know yet whether the
+    // picture can accumulate, and so whether finished pipes are kept and
+    // the caps of the first pipes recorded
+    InitPipes();
+}
+
+void PipesGLView::DetachedFromWindow() {
+    LockGL();
+    if (fAccumulateFramebuffer != 0) {
+        glDeleteFramebuffers(1, &fAccumulateFramebuffer);
+        glDeleteRenderbuffers(2, fAccumulateRenderbuffers);
+        fAccumulateFramebuffer = 0;
+        fAccumulateWidth = fAccumulateHeight = 0;
+    }
+    if (fInstanceProgram != 0) {
+        glDeleteProgram(fInstanceProgram);
+        glDeleteBuffers(2, fMeshBuffers);
+        glDeleteBuffers(1, &fInstanceBuffer);
+        fInstanceProgram = 0;
+        fInstancingSupported = false;
+    }
+    UnlockGL();
+    BGLView::DetachedFromWindow();
 }
 
 void PipesGLView::Draw(BRect updateRect) {
     LockGL();
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (fProjectionChanged)
+        SetProjection();
+    UpdateCamera();
+    bool accumulating = Accumulating() && BeginAccumulation();
+    if (!accumulating)
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glLoadIdentity();
-    gluLookAt(0.0, 0.0, 20.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+    gluLookAt(fCameraPosition.x, fCameraPosition.y, fCameraPosition.z,
+        fCameraTarget.x, fCameraTarget.y, fCameraTarget.z, 0.0, 1.0, 0.0);
+
+    if (Flying()) {
+        glFogf(GL_FOG_START, 0.5f * kViewDistance * fSegmentLength);
+        glFogf(GL_FOG_END, kViewDistance * fSegmentLength);
+        glEnable(GL_FOG);
+    } else {
+        glDisable(GL_FOG);
+    }
 
     UpdatePipes();
-    DrawPipes();
+    if (accumulating) {
+        // A full volume starts over within UpdatePipes()
+        if (fAccumulateClearPending) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            fAccumulateClearPending = false;
+        }
+        CollectNewPieces();
+        DrawInstances();
+        EndAccumulation();
+    } else {
+        CollectPipes();
+        DrawInstances();
+        if (fReportCulling)
+            ReportChunks();
+    }
 
     SwapBuffers();
     UnlockGL();
 }
 
-void PipesGLView::SetParameters(int32 pipeCount, float segmentLength, float pipeRadius) {
+void PipesGLView::SetParameters(int32 pipeCount, int32 volumeSize, float segmentLength,
+        float pipeRadius, bool accumulate, uint32 seed) {
     fPipeCount = pipeCount;
+    fVolumeSize = volumeSize;
     fSegmentLength = segmentLength;
     fPipeRadius = pipeRadius;
+    fAccumulate = accumulate;
+    fSeed = seed;
+    // The camera starts over with the scene
+    fCameraTime = 0.0;
     InitPipes();
 }
 
 void PipesGLView::InitPipes() {
-    memset(grid, 0, sizeof(grid));
-    pipes.clear();
-    for (int i = 0; i < fPipeCount; ++i) {
-        AddNewPipe();
+    BuildMeshes();
+    PlaceCamera();
+    fProjectionChanged = true;
+    // Start the accumulated picture over with the next frame
+    fAccumulateClearPending = true;
+    fNewPieces.clear();
+    fGrowth.SetKeepFinished(Accumulating());
+    fGrowth.ClearFocus();
+    fGrowth.Reset(fPipeCount, fVolumeSize, fSeed);
+    for (const auto& event : fGrowth.Events())
+        AddPieces(event);
+    fGrowth.ClearEvents();
+}
+
+void PipesGLView::BuildMeshes() {
+    fMeshVertices.clear();
+    fMeshIndices.clear();
+    std::vector<PipeVertex> vertices;
+    float half = 0.5f * fSegmentLength;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        const int* direction = kDirections[axis * 2];
+        float u[3], v[3];
+        CrossSection(axis * 2, u, v);
+        vertices.clear();
+        for (int end = -1; end <= 1; end += 2) {
+            float center[3] = { end * half * direction[0], end * half * direction[1],
+                end * half * direction[2] };
+            AddRing(vertices, center, u, v, fPipeRadius);
+        }
+        AddMesh(kMeshCylinder + axis, vertices, kCylinderSlices + 1);
+    }
+
+    for (int direction = 0; direction < 6; ++direction) {
+        const int* axis = kDirections[direction];
+        float u[3], v[3];
+        CrossSection(direction, u, v);
+        float start[3] = { 0.0f, 0.0f, 0.0f };
+        float end[3] = { half * axis[0], half * axis[1], half * axis[2] };
+        vertices.clear();
+        AddRing(vertices, start, u, v, fPipeRadius);
+        AddRing(vertices, end, u, v, fPipeRadius);
+        AddMesh(kMeshHalfCylinder + direction, vertices, kCylinderSlices + 1);
+    }
+
+    float sphereRadius = fPipeRadius * 1.1f;
+    vertices.clear();
+    for (int stack = 0; stack <= kSphereStacks; ++stack) {
+        float phi = M_PI * stack / kSphereStacks;
+        for (int slice = 0; slice <= kSphereSlices; ++slice) {
+            float theta = 2.0f * M_PI * slice / kSphereSlices;
+            PipeVertex vertex;
+            vertex.nx = sinf(phi) * cosf(theta);
+            vertex.ny = sinf(phi) * sinf(theta);
+            vertex.nz = cosf(phi);
+            vertex.x = sphereRadius * vertex.nx;
+            vertex.y = sphereRadius * vertex.ny;
+            vertex.z = sphereRadius * vertex.nz;
+            vertices.push_back(vertex);
+        }
+    }
+    AddMesh(kMeshSphere, vertices, kSphereSlices + 1);
+
+    // An elbow bends from the middle of the face the pipe enters through
+    // (in direction a) to the middle of the face it leaves through (in
+    // direction b), around the edge of the cell between the two. Its rings
+    // are the cross section of the entry rotated about a x b, so they line
+    // up with the cylinder before the turn.
+    int mesh = kMeshElbow;
+    for (int a = 0; a < 6; ++a) {
+        for (int b = 0; b < 6; ++b) {
+            fElbowMeshes[a][b] = -1;
+            if (a / 2 == b / 2)
+                continue;
+
+            float da[3] = { (float)kDirections[a][0], (float)kDirections[a][1],
+                (float)kDirections[a][2] };
+            float db[3] = { (float)kDirections[b][0], (float)kDirections[b][1],
+                (float)kDirections[b][2] };
+            float normal[3] = { da[1] * db[2] - da[2] * db[1], da[2] * db[0] - da[0] * db[2],
+                da[0] * db[1] - da[1] * db[0] };
+            float u[3], v[3];
+            CrossSection(a, u, v);
+            float uB = u[0] * db[0] + u[1] * db[1] + u[2] * db[2];
+            float uN = u[0] * normal[0] + u[1] * normal[1] + u[2] * normal[2];
+            float vB = v[0] * db[0] + v[1] * db[1] + v[2] * db[2];
+            float vN = v[0] * normal[0] + v[1] * normal[1] + v[2] * normal[2];
+
+            vertices.clear();
+            for (int step = 0; step <= kElbowSteps; ++step) {
+                float t = 0.5f * M_PI * step / kElbowSteps;
+                // Direction from the bend's axis to the ring's center; the
+                // rotation takes b to its opposite
+                float radial[3], center[3], ringU[3], ringV[3];
+                for (int i = 0; i < 3; ++i) {
+                    radial[i] = sinf(t) * da[i] - cosf(t) * db[i];
+                    center[i] = half * (db[i] - da[i]) + half * radial[i];
+                    ringU[i] = -uB * radial[i] + uN * normal[i];
+                    ringV[i] = -vB * radial[i] + vN * normal[i];
+                }
+                AddRing(vertices, center, ringU, ringV, fPipeRadius);
+            }
+            fElbowMeshes[a][b] = mesh;
+            AddMesh(mesh++, vertices, kCylinderSlices + 1);
+        }
+    }
+    fMeshesChanged = true;
+}
+
+// Adds a mesh made of rings of vertices, as one triangle strip. The strips
+// between consecutive rings are stitched with degenerate triangles.
+void PipesGLView::AddMesh(int mesh, const std::vector<PipeVertex>& vertices, int ringVertices) {
+    GLushort base = fMeshVertices.size();
+    int rings = vertices.size() / ringVertices;
+    fMeshFirstIndex[mesh] = fMeshIndices.size();
+    for (int ring = 0; ring + 1 < rings; ++ring) {
+        GLushort row = base + ring * ringVertices;
+        if (ring > 0) {
+            fMeshIndices.push_back(fMeshIndices.back());
+            fMeshIndices.push_back(row + ringVertices);
+        }
+        for (int i = 0; i < ringVertices; ++i) {
+            fMeshIndices.push_back(row + ringVertices + i);
+            fMeshIndices.push_back(row + i);
+        }
     }
+    fMeshIndexCount[mesh] = fMeshIndices.size() - fMeshFirstIndex[mesh];
+    fMeshVertices.insert(fMeshVertices.end(), vertices.begin(), vertices.end());
 }
 
-void PipesGLView::AddNewPipe() {
-    Pipe pipe;
-    pipe.r = (float)rand() / RAND_MAX;
-    pipe.g = (float)rand() / RAND_MAX;
-    pipe.b = (float)rand() / RAND_MAX;
-    pipe.direction = rand() % 6;
+// Center of the cell in scene coordinates; the volume is centered on the origin
+void PipesGLView::CellPosition(PipeCell cell, Point3D& position) const {
+    int center = fGrowth.Volume().Size() / 2;
+    position.x = (PipeVolume::CellX(cell) - center) * fSegmentLength;
+    position.y = (PipeVolume::CellY(cell) - center) * fSegmentLength;
+    position.z = (PipeVolume::CellZ(cell) - center) * fSegmentLength;
+}
 
-    Point3D start;
-    do {
-        start.x = rand() % GRID_SIZE - GRID_SIZE / 2;
-        start.y = rand() % GRID_SIZE - GRID_SIZE / 2;
-        start.z = rand() % GRID_SIZE - GRID_SIZE / 2;
-    } while (grid[(int)start.x + GRID_SIZE/2][(int)start.y + GRID_SIZE/2][(int)start.z + GRID_SIZE/2]);
+// The reverse of CellPosition(), without rounding to a cell
+void PipesGLView::CellCoordinates(const Point3D& position, float coordinates[3]) const {
+    int center = fGrowth.Volume().Size() / 2;
+    coordinates[0] = position.x / fSegmentLength + center;
+    coordinates[1] = position.y / fSegmentLength + center;
+    coordinates[2] = position.z / fSegmentLength + center;
+}
 
-    pipe.segments.push_back(start);
-    grid[(int)start.x + GRID_SIZE/2][(int)start.y + GRID_SIZE/2][(int)start.z + GRID_SIZE/2] = true;
-    pipes.push_back(pipe);
+float PipesGLView::CameraDistanceSquared(const Point3D& position) const {
+    float dx = position.x - fCameraPosition.x;
+    float dy = position.y - fCameraPosition.y;
+    float dz = position.z - fCameraPosition.z;
+    return dx * dx + dy * dy + dz * dz;
 }
 
-void PipesGLView::UpdatePipes() {
-    for (auto& pipe : pipes) {
-        Point3D& last = pipe.segments.back();
-        Point3D nextPoint = last;  // Initialize next point as the current segment position
-        bool moved = false;
-        
-        // Set chance for random direction change (e.g., 1 in 10 steps)
-        bool randomTurn = rand() % 10 == 0;
-
-        // Try to move in the current direction if possible
-        if (!randomTurn) {
-            // Calculate the next position in the current direction
-            switch (pipe.direction) {
-                case 0: nextPoint.x += fSegmentLength; break;  // X+
-                case 1: nextPoint.x -= fSegmentLength; break;  // X-
-                case 2: nextPoint.y += fSegmentLength; break;  // Y+
-                case 3: nextPoint.y -= fSegmentLength; break;  // Y-
-                case 4: nextPoint.z += fSegmentLength; break;  // Z+
-                case 5: nextPoint.z -= fSegmentLength; break;  // Z-
-            }
+// Point on the camera's flight, a Lissajous curve through the volume
+void PipesGLView::CameraPath(double time, Point3D& position) const {
+    float amplitude = CameraAmplitude();
+    position.x = amplitude * sin(time);
+    position.y = amplitude * sin(1.3 * time + 1.0);
+    position.z = amplitude * sin(0.7 * time + 2.0);
+}
 
-            // Check if the next point is within grid bounds and not occupied
-            if (nextPoint.x >= -GRID_SIZE / 2 && nextPoint.x < GRID_SIZE / 2 &&
-                nextPoint.y >= -GRID_SIZE / 2 && nextPoint.y < GRID_SIZE / 2 &&
-                nextPoint.z >= -GRID_SIZE / 2 && nextPoint.z < GRID_SIZE / 2 &&
-                !grid[(int)roundf(nextPoint.x + GRID_SIZE / 2)]
-                     [(int)roundf(nextPoint.y + GRID_SIZE / 2)]
-                     [(int)roundf(nextPoint.z + GRID_SIZE / 2)]) {
-
-                moved = true;  // Pipe can move in the current direction
-                pipe.segments.push_back(nextPoint);
-                grid[(int)roundf(nextPoint.x + GRID_SIZE / 2)]
-                    [(int)roundf(nextPoint.y + GRID_SIZE / 2)]
-                    [(int)roundf(nextPoint.z + GRID_SIZE / 2)] = true;
-            }
-        }
+void PipesGLView::UpdateCamera() {
+    if (Flying())
+        fCameraTime += kCameraSpeed * fSegmentLength / CameraAmplitude();
+    PlaceCamera();
+}
 
-        // If the pipe didn't move in its current direction, try random directions
-        if (!moved) {
-            for (int attempts = 0; attempts < 6 && !moved; ++attempts) {
-                nextPoint = last;  // Reset next point to the current position
-                pipe.direction = rand() % 6;  // Choose a random direction
-
-                // Move in the new random direction
-                switch (pipe.direction) {
-                    case 0: nextPoint.x += fSegmentLength; break;  // X+
-                    case 1: nextPoint.x -= fSegmentLength; break;  // X-
-                    case 2: nextPoint.y += fSegmentLength; break;  // Y+
-                    case 3: nextPoint.y -= fSegmentLength; break;  // Y-
-                    case 4: nextPoint.z += fSegmentLength; break;  // Z+
-                    case 5: nextPoint.z -= fSegmentLength; break;  // Z-
-                }
+// The depth range grows with the distance of the still camera, so that
+// depth precision stays the same
+void PipesGLView::SetProjection() {
+    float scale = Flying() ? 1.0f : StillScale();
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0, fWidth / fHeight, 0.1 * scale, 100.0 * scale);
+    glMatrixMode(GL_MODELVIEW);
+    fProjectionChanged = false;
+}
 
-                // Check if the new direction is valid
-                if (nextPoint.x >= -GRID_SIZE / 2 && nextPoint.x < GRID_SIZE / 2 &&
-                    nextPoint.y >= -GRID_SIZE / 2 && nextPoint.y < GRID_SIZE / 2 &&
-                    nextPoint.z >= -GRID_SIZE / 2 && nextPoint.z < GRID_SIZE / 2 &&
-                    !grid[(int)roundf(nextPoint.x + GRID_SIZE / 2)]
-                         [(int)roundf(nextPoint.y + GRID_SIZE / 2)]
-                         [(int)roundf(nextPoint.z + GRID_SIZE / 2)]) {
-
-                    moved = true;  // The pipe can move in this new direction
-                    pipe.segments.push_back(nextPoint);
-                    grid[(int)roundf(nextPoint.x + GRID_SIZE / 2)]
-                        [(int)roundf(nextPoint.y + GRID_SIZE / 2)]
-                        [(int)roundf(nextPoint.z + GRID_SIZE / 2)] = true;
-                }
-            }
-        }
+void PipesGLView::PlaceCamera() {
+    if (!Flying()) {
+        fCameraPosition.x = fCameraPosition.y = 0.0f;
+        fCameraPosition.z = 20.0f * StillScale();
+        fCameraTarget.x = fCameraTarget.y = fCameraTarget.z = 0.0f;
+        fSpawnCenter = fCameraTarget;
+        return;
+    }
 
-        // If the pipe could not move in any direction, destroy it and create a new one
-        if (!moved) {
-            // Free up the grid cells occupied by the current pipe
-            for (const auto& segment : pipe.segments) {
-                grid[(int)roundf(segment.x + GRID_SIZE / 2)]
-                    [(int)roundf(segment.y + GRID_SIZE / 2)]
-                    [(int)roundf(segment.z + GRID_SIZE / 2)] = false;
-            }
+    float amplitude = CameraAmplitude();
+    CameraPath(fCameraTime, fCameraPosition);
+    CameraPath(fCameraTime + 4.0f * fSegmentLength / amplitude, fCameraTarget);
+    CameraPath(fCameraTime + 0.5f * kViewDistance * fSegmentLength / amplitude, fSpawnCenter);
+}
 
-            // Restart the pipe with a new random initial position
-            pipe.segments.clear();
-            Point3D newStart;
-            newStart.x = rand() % GRID_SIZE - GRID_SIZE / 2;
-            newStart.y = rand() % GRID_SIZE - GRID_SIZE / 2;
-            newStart.z = rand() % GRID_SIZE - GRID_SIZE / 2;
+void PipesGLView::UpdatePipes() {
+    fGrowth.SetKeepFinished(Accumulating());
+    if (Flying()) {
+        // Pipes the camera has left behind start over ahead of it
+        float camera[3], spawn[3];
+        CellCoordinates(fCameraPosition, camera);
+        CellCoordinates(fSpawnCenter, spawn);
+        fGrowth.SetFocus(camera, 1.5f * kViewDistance, spawn, (int)(kViewDistance / 2));
+    } else {
+        fGrowth.ClearFocus();
+    }
 
-            pipe.segments.push_back(newStart);
+    // A volume filled by accumulated pipes starts over
+    if (fGrowth.Step()) {
+        fAccumulateClearPending = true;
+        fNewPieces.clear();
+    }
+    for (const auto& event : fGrowth.Events())
+        AddPieces(event);
+    fGrowth.ClearEvents();
+}
 
-            grid[(int)roundf(newStart.x + GRID_SIZE / 2)]
-                [(int)roundf(newStart.y + GRID_SIZE / 2)]
-                [(int)roundf(newStart.z + GRID_SIZE / 2)] = true;
+// Turns what happened to a pipe into the meshes to add to the accumulated
+// picture
+void PipesGLView::AddPieces(const PipeEvent& event) {
+    const Pipe& pipe = fGrowth.Pipes()[event.pipe];
+    switch (event.type) {
+        case PipeEvent::kStarted:
+        case PipeEvent::kFinished:
+            AddPiece(event, kMeshSphere, event.cell);
+            break;
+        case PipeEvent::kGrew: {
+            // The previous head turns into a straight piece or an elbow, or
+            // into the open end of the pipe if it was its first cell
+            int direction = pipe.Direction(pipe.cellCount - 1);
+            AddPiece(event, pipe.cellCount == 2 ? kMeshHalfCylinder + direction
+                : CellMesh(pipe.Direction(pipe.cellCount - 2), direction),
+                pipe.Cell(pipe.cellCount - 2));
+            AddPiece(event, kMeshHalfCylinder + (direction ^ 1), event.cell);
+            break;
         }
+    }
+}
+
+void PipesGLView::AddPiece(const PipeEvent& event, int mesh, PipeCell cell) {
+    PipePiece piece = { mesh, cell, event.r, event.g, event.b };
+    fNewPieces.push_back(piece);
+}
+
+void PipesGLView::AddInstance(const Pipe& pipe, int mesh, const Point3D& position) {
+    PipeInstance instance = { position.x, position.y, position.z, pipe.r, pipe.g, pipe.b };
+    fInstances[mesh].push_back(instance);
+}
 
-        // Remove the oldest segments if the pipe has grown too long
-        if (pipe.segments.size() > 25) {
-            Point3D& first = pipe.segments.front();
-            grid[(int)roundf(first.x + GRID_SIZE / 2)]
-                [(int)roundf(first.y + GRID_SIZE / 2)]
-                [(int)roundf(first.z + GRID_SIZE / 2)] = false;
-            pipe.segments.erase(pipe.segments.begin());
+// Gathers the meshes of all cells of all pipes
+void PipesGLView::CollectPipes() {
+    for (auto& instances : fInstances)
+        instances.clear();
+
+    // When flying, cells beyond the fog are left out as well
+    bool flying = Flying();
+    float limit = (kViewDistance + 2.0f) * fSegmentLength;
+
+    UpdateFrustum();
+    fChunkVisibility.clear();
+    fDrawnChunkCount = 0;
+
+    for (const auto& pipe : fGrowth.Pipes()) {
+        // Consecutive cells mostly share their brick
+        uint32_t chunk = 0;
+        bool visible = false;
+        for (int i = 0; i < pipe.cellCount; ++i) {
+            PipeCell cell = pipe.Cell(i);
+            if (i == 0 || PipeVolume::BrickNumber(cell) != chunk) {
+                chunk = PipeVolume::BrickNumber(cell);
+                visible = ChunkVisible(chunk);
+            }
+            if (!visible)
+                continue;
+
+            Point3D position;
+            CellPosition(cell, position);
+            if (flying && CameraDistanceSquared(position) > limit * limit)
+                continue;
+
+            if (pipe.cellCount == 1) {
+                AddInstance(pipe, kMeshSphere, position);
+            } else if (i == 0) {
+                AddInstance(pipe, kMeshHalfCylinder + pipe.Direction(1), position);
+                AddInstance(pipe, kMeshSphere, position);
+            } else if (i == pipe.cellCount - 1) {
+                AddInstance(pipe, kMeshHalfCylinder + (pipe.Direction(i) ^ 1), position);
+                AddInstance(pipe, kMeshSphere, position);
+            } else {
+                AddInstance(pipe, CellMesh(pipe.Direction(i), pipe.Direction(i + 1)), position);
+            }
         }
     }
 }
 
-void PipesGLView::DrawPipes() {
-    for (const auto& pipe : pipes) {
-        glColor3f(pipe.r, pipe.g, pipe.b);
-        for (size_t i = 1; i < pipe.segments.size(); ++i) {
-            DrawPipeSegment(pipe.segments[i-1], pipe.segments[i]);
-            if (i < pipe.segments.size() - 1) {
-                DrawJoint(pipe.segments[i-1], pipe.segments[i], pipe.segments[i+1]);
-            }
+// Takes the planes of the view frustum from the current matrices, as
+// a * x + b * y + c * z + d >= 0 for the points inside
+void PipesGLView::UpdateFrustum() {
+    GLfloat projection[16], modelView[16], matrix[16];
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+    // Column-major: element (row, column) is at column * 4 + row
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (int i = 0; i < 4; ++i)
+                sum += projection[i * 4 + row] * modelView[column * 4 + i];
+            matrix[column * 4 + row] = sum;
         }
     }
+
+    // Left, right, bottom, top, near and far: the last row of the matrix
+    // plus or minus one of the others
+    for (int plane = 0; plane < 6; ++plane) {
+        int row = plane / 2;
+        float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+        for (int i = 0; i < 4; ++i)
+            fFrustum[plane][i] = matrix[i * 4 + 3] + sign * matrix[i * 4 + row];
+    }
 }
 
-void PipesGLView::DrawPipeSegment(const Point3D& start, const Point3D& end) {
-    glPushMatrix();
+// Whether any of the brick's cells can be in view, including the parts of
+// their meshes that reach into the neighbouring cells
+bool PipesGLView::ChunkVisible(uint32_t chunk) {
+    auto found = fChunkVisibility.find(chunk);
+    if (found != fChunkVisibility.end())
+        return found->second;
+
+    const int size = PipeVolume::kBrickSize;
+    PipeCell first = PipeVolume::Cell((chunk & 63) * size, (chunk >> 6 & 63) * size,
+        (chunk >> 12 & 63) * size);
+    Point3D low;
+    CellPosition(first, low);
+    float margin = 0.5f * fSegmentLength + 1.1f * fPipeRadius;
+    float extent = (size - 1) * fSegmentLength + 2.0f * margin;
+    low.x -= margin;
+    low.y -= margin;
+    low.z -= margin;
+
+    // The box is out if its corner furthest along the normal of a plane is
+    // outside of it
+    bool visible = true;
+    for (int plane = 0; plane < 6 && visible; ++plane) {
+        const float* p = fFrustum[plane];
+        float x = low.x + (p[0] > 0.0f ? extent : 0.0f);
+        float y = low.y + (p[1] > 0.0f ? extent : 0.0f);
+        float z = low.z + (p[2] > 0.0f ? extent : 0.0f);
+        visible = p[0] * x + p[1] * y + p[2] * z + p[3] >= 0.0f;
+    }
 
-    // Translate to the starting point of the segment
-    glTranslatef(start.x, start.y, start.z);
+    fChunkVisibility[chunk] = visible;
+    if (visible)
+        fDrawnChunkCount++;
+    return visible;
+}
 
-    // Calculate the direction vector from start to end
-    Point3D dir = {end.x - start.x, end.y - start.y, end.z - start.z};
-    float length = sqrtf(dir.x*dir.x + dir.y*dir.y + dir.z*dir.z);
+// Logs how many of the bricks holding pipes were in view, on average over
+// the last 250 frames drawn in full
+void PipesGLView::ReportChunks() {
+    fChunkSum += CountChunks();
+    fDrawnChunkSum += CountDrawnChunks();
+    if (++fReportFrameCount < 250)
+        return;
+
+    syslog(LOG_INFO, "3D Pipes: %d pipes, %.1f of %.1f bricks drawn", (int)fPipeCount,
+        (double)fDrawnChunkSum / fReportFrameCount, (double)fChunkSum / fReportFrameCount);
+    fReportFrameCount = 0;
+    fChunkSum = 0;
+    fDrawnChunkSum = 0;
+}
 
-    // Normalize the direction vector
-    dir.x /= length;
-    dir.y /= length;
-    dir.z /= length;
+// Gathers the meshes placed since the last frame
+void PipesGLView::CollectNewPieces() {
+    for (auto& instances : fInstances)
+        instances.clear();
+
+    for (const auto& piece : fNewPieces) {
+        Point3D position;
+        CellPosition(piece.cell, position);
+        PipeInstance instance = { position.x, position.y, position.z, piece.r, piece.g,
+            piece.b };
+        fInstances[piece.mesh].push_back(instance);
+    }
+    fNewPieces.clear();
+}
+
+void PipesGLView::DrawInstances() {
+    if (fMeshesChanged)
+        UploadMeshes();
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+
+    if (fInstancingSupported) {
+        // The instances of all meshes go into one buffer, mesh after mesh
+        int starts[kMeshCount];
+        fInstanceData.clear();
+        for (int mesh = 0; mesh < kMeshCount; ++mesh) {
+            starts[mesh] = fInstanceData.size();
+            fInstanceData.insert(fInstanceData.end(), fInstances[mesh].begin(),
+                fInstances[mesh].end());
+        }
 
-    // Calculate the rotation angle relative to the axes
-    float rotAngle = acosf(dir.z) * 180.0f / M_PI;  // Angle between the pipe direction and the Z-axis
-    float rotationAxisX = -dir.y; // Rotate around the Y-axis
-    float rotationAxisY = dir.x;  // Rotate around the X-axis
+        glBindBuffer(GL_ARRAY_BUFFER, fMeshBuffers[0]);
+        glVertexPointer(3, GL_FLOAT, sizeof(PipeVertex), (const void*)offsetof(PipeVertex, x));
+        glNormalPointer(GL_FLOAT, sizeof(PipeVertex), (const void*)offsetof(PipeVertex, nx));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, fMeshBuffers[1]);
+        glBindBuffer(GL_ARRAY_BUFFER, fInstanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, fInstanceData.size() * sizeof(PipeInstance),
+            fInstanceData.data(), GL_STREAM_DRAW);
+
+        glUseProgram(fInstanceProgram);
+        glUniform1i(fFogUniform, glIsEnabled(GL_FOG));
+        glEnableVertexAttribArray(kOffsetAttribute);
+        glEnableVertexAttribArray(kColorAttribute);
+        glVertexAttribDivisor(kOffsetAttribute, 1);
+        glVertexAttribDivisor(kColorAttribute, 1);
+
+        for (int mesh = 0; mesh < kMeshCount; ++mesh) {
+            if (fInstances[mesh].empty())
+                continue;
+            size_t offset = starts[mesh] * sizeof(PipeInstance);
+            glVertexAttribPointer(kOffsetAttribute, 3, GL_FLOAT, GL_FALSE, sizeof(PipeInstance),
+                (const void*)(offset + offsetof(PipeInstance, x)));
+            glVertexAttribPointer(kColorAttribute, 3, GL_FLOAT, GL_FALSE, sizeof(PipeInstance),
+                (const void*)(offset + offsetof(PipeInstance, r)));
+            glDrawElementsInstanced(GL_TRIANGLE_STRIP, fMeshIndexCount[mesh], GL_UNSIGNED_SHORT,
+                (const void*)(fMeshFirstIndex[mesh] * sizeof(GLushort)), fInstances[mesh].size());
+        }
 
-    // Rotate the pipe relative to the calculated axis
-    if (fabs(dir.z) < 0.99f) {
-        glRotatef(rotAngle, rotationAxisX, rotationAxisY, 0.0f);
-    } else if (dir.z < 0) {
-        glRotatef(180.0f, 1.0f, 0.0f, 0.0f);  // To flip around the Z-axis if direction is downward
+        glDisableVertexAttribArray(kColorAttribute);
+        glDisableVertexAttribArray(kOffsetAttribute);
+        glUseProgram(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    } else {
+        glVertexPointer(3, GL_FLOAT, sizeof(PipeVertex), &fMeshVertices[0].x);
+        glNormalPointer(GL_FLOAT, sizeof(PipeVertex), &fMeshVertices[0].nx);
+        for (int mesh = 0; mesh < kMeshCount; ++mesh) {
+            for (const auto& instance : fInstances[mesh]) {
+                glColor3f(instance.r, instance.g, instance.b);
+                glPushMatrix();
+                glTranslatef(instance.x, instance.y, instance.z);
+                glDrawElements(GL_TRIANGLE_STRIP, fMeshIndexCount[mesh], GL_UNSIGNED_SHORT,
+                    &fMeshIndices[fMeshFirstIndex[mesh]]);
+                glPopMatrix();
+            }
+        }
     }
 
-    // Draw the cylinder
-    GLUquadricObj *quadric = gluNewQuadric();
-    gluQuadricDrawStyle(quadric, GLU_FILL);
-    gluQuadricNormals(quadric, GLU_SMOOTH);
-    gluCylinder(quadric, fPipeRadius, fPipeRadius, length, 14, 1);
-    gluDeleteQuadric(quadric);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-    glPopMatrix();
+// Builds the instancing shader and its buffers. Returns false if the shader
+// does not build; every instance is then drawn on its own.
+bool PipesGLView::InitInstancing() {
+    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, kInstanceVertexShader);
+    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, kInstanceFragmentShader);
+    GLuint program = 0;
+    if (vertexShader != 0 && fragmentShader != 0) {
+        program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glBindAttribLocation(program, kOffsetAttribute, "offset");
+        glBindAttribLocation(program, kColorAttribute, "color");
+        glLinkProgram(program);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (linked != GL_TRUE) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    // Deleting 0 is ignored, and attached shaders go with their program
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    if (program == 0)
+        return false;
+
+    fInstanceProgram = program;
+    fFogUniform = glGetUniformLocation(program, "fog");
+    glGenBuffers(2, fMeshBuffers);
+    glGenBuffers(1, &fInstanceBuffer);
+    fMeshesChanged = true;
+    return true;
 }
 
+// Moves rebuilt meshes into their buffer objects
+void PipesGLView::UploadMeshes() {
+    fMeshesChanged = false;
+    if (!fInstancingSupported)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, fMeshBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, fMeshVertices.size() * sizeof(PipeVertex),
+        fMeshVertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, fMeshBuffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, fMeshIndices.size() * sizeof(GLushort),
+        fMeshIndices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
 
-void PipesGLView::DrawJoint(const Point3D& prev, const Point3D& current, const Point3D& next) {
-    glPushMatrix();
-    glTranslatef(current.x, current.y, current.z);
+// Binds the persistent framebuffer, (re)allocating it to the size of the
+// view. Returns false if it cannot be used, the caller then draws normally.
+bool PipesGLView::BeginAccumulation() {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &fTargetFramebuffer);
+
+    if (viewport[2] != fAccumulateWidth || viewport[3] != fAccumulateHeight) {
+        if (fAccumulateFramebuffer == 0) {
+            glGenFramebuffers(1, &fAccumulateFramebuffer);
+            glGenRenderbuffers(2, fAccumulateRenderbuffers);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, fAccumulateRenderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, viewport[2], viewport[3]);
+        glBindRenderbuffer(GL_RENDERBUFFER, fAccumulateRenderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, viewport[2], viewport[3]);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fAccumulateFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_RENDERBUFFER, fAccumulateRenderbuffers[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+            GL_RENDERBUFFER, fAccumulateRenderbuffers[1]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fTargetFramebuffer);
+            fFramebufferSupported = false;
+            return false;
+        }
+        fAccumulateWidth = viewport[2];
+        fAccumulateHeight = viewport[3];
+        fAccumulateClearPending = true;
+    } else {
+        glBindFramebuffer(GL_FRAMEBUFFER, fAccumulateFramebuffer);
+    }
 
-    GLUquadricObj *quadric = gluNewQuadric();
-    gluQuadricDrawStyle(quadric, GLU_FILL);
-    gluQuadricNormals(quadric, GLU_SMOOTH);
-    gluSphere(quadric, fPipeRadius * 1.1, 16, 16);
-    gluDeleteQuadric(quadric);
+    if (fAccumulateClearPending) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        fAccumulateClearPending = false;
+    }
+    return true;
+}
 
-    glPopMatrix();
+// Copies the accumulated picture to the view
+void PipesGLView::EndAccumulation() {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fAccumulateFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fTargetFramebuffer);
+    glBlitFramebuffer(0, 0, fAccumulateWidth, fAccumulateHeight,
+        0, 0, fAccumulateWidth, fAccumulateHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fTargetFramebuffer);
 }
 
 // Implementation of PipesScreenSaver
 
 PipesScreenSaver::PipesScreenSaver(BMessage* archive, image_id image)
     : BScreenSaver(archive, image), fGLView(nullptr),
-      fPipeCount(10), fSegmentLength(1.0f), fPipeRadius(0.1f) {
+      fPipeCount(10), fVolumeSize(kDefaultVolumeSize), fSegmentLength(1.0f), fPipeRadius(0.1f),
+      fAccumulate(false), fReportCulling(false), fSeed(NewSceneSeed()) {
         RestoreState(archive);
 }
 
@@ -437,6 +1203,10 @@ void PipesScreenSaver::StartConfig(BView* view) {
 status_t PipesScreenSaver::SaveState(BMessage* into) const {
     into->AddInt32("pipe_count", fPipeCount);
     into->AddFloat("pipe_radius", fPipeRadius);
+    into->AddInt32("volume_size", fVolumeSize);
+    into->AddBool("accumulate", fAccumulate);
+    into->AddBool("report_culling", fReportCulling);
+    into->AddInt32("scene_seed", (int32)fSeed);
     return B_OK;
 }
 
@@ -447,6 +1217,16 @@ void PipesScreenSaver::RestoreState(BMessage* from)
             fPipeCount = 10;
         if (from->FindFloat("pipe_radius", &fPipeRadius) != B_OK)
             fPipeRadius = 0.1f;
+        if (from->FindInt32("volume_size", &fVolumeSize) != B_OK)
+            fVolumeSize = kDefaultVolumeSize;
+        if (from->FindBool("accumulate", &fAccumulate) != B_OK)
+            fAccumulate = false;
+        if (from->FindBool("report_culling", &fReportCulling) != B_OK)
+            fReportCulling = false;
+        // Without a stored seed, the one picked by the constructor stays
+        int32 seed;
+        if (from->FindInt32("scene_seed", &seed) == B_OK)
+            fSeed = (uint32)seed;
     }
 }
 
@@ -456,7 +1236,8 @@ status_t PipesScreenSaver::StartSaver(BView* view, bool preview) {
         fGLView = new PipesGLView(bounds);
         view->AddChild(fGLView);
     }
-    fGLView->SetParameters(fPipeCount, fSegmentLength, fPipeRadius);
+    fGLView->SetParameters(fPipeCount, fVolumeSize, fSegmentLength, fPipeRadius, fAccumulate, fSeed);
+    fGLView->SetReportCulling(fReportCulling);
     view->Window()->SetPulseRate(50000);
     return B_OK;
 }
@@ -469,12 +1250,32 @@ void PipesScreenSaver::Draw(BView* view, int32 frame) {
 
 void PipesScreenSaver::SetPipeCount(int32 count) {
     fPipeCount = count;
-    if (fGLView) fGLView->SetParameters(fPipeCount, fSegmentLength, fPipeRadius);
+    if (fGLView) fGLView->SetParameters(fPipeCount, fVolumeSize, fSegmentLength, fPipeRadius, fAccumulate, fSeed);
 }
 
 void PipesScreenSaver::SetPipeRadius(float radius) {
     fPipeRadius = radius;
-    if (fGLView) fGLView->SetParameters(fPipeCount, fSegmentLength, fPipeRadius);
+    if (fGLView) fGLView->SetParameters(fPipeCount, fVolumeSize, fSegmentLength, fPipeRadius, fAccumulate, fSeed);
+}
+
+void PipesScreenSaver::SetVolumeSize(int32 size) {
+    fVolumeSize = size;
+    if (fGLView) fGLView->SetParameters(fPipeCount, fVolumeSize, fSegmentLength, fPipeRadius, fAccumulate, fSeed);
+}
+
+void PipesScreenSaver::SetAccumulate(bool accumulate) {
+    fAccumulate = accumulate;
+    if (fGLView) fGLView->SetParameters(fPipeCount, fVolumeSize, fSegmentLength, fPipeRadius, fAccumulate, fSeed);
+}
+
+void PipesScreenSaver::SetReportCulling(bool report) {
+    fReportCulling = report;
+    if (fGLView) fGLView->SetReportCulling(fReportCulling);
+}
+
+void PipesScreenSaver::SetSeed(uint32 seed) {
+    fSeed = seed;
+    if (fGLView) fGLView->SetParameters(fPipeCount, fVolumeSize, fSegmentLength, fPipeRadius, fAccumulate, fSeed);
 }
 
 // Function to create an instance of the screensaver
@@ -0,0 +1,92 @@
+/*
+ * FreeCellList.h
+ *
+ * The free cells of a small, dense volume, kept as an unordered list with
+ * the position of every cell in it. Cells are taken and released in O(1)
+ * by swapping with the last entry, and a random free cell is one index
+ * away, however full the volume is.
+ *
+ * The index costs four bytes per cell of the volume, so the list is only
+ * meant for volumes that are small enough to fill up.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef FREE_CELL_LIST_H
+#define FREE_CELL_LIST_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "PipeVolume.h"
+
+class FreeCellList {
+public:
+    FreeCellList() : fSize(0) { }
+
+    // Starts over with all cells of a size^3 volume free
+    void Reset(int size) {
+        fSize = size;
+        fCells.clear();
+        fPositions.resize((size_t)size * size * size);
+        for (int z = 0; z < size; ++z) {
+            for (int y = 0; y < size; ++y) {
+                for (int x = 0; x < size; ++x) {
+                    fPositions[Index(x, y, z)] = (int32_t)fCells.size();
+                    fCells.push_back(PipeVolume::Cell(x, y, z));
+                }
+            }
+        }
+    }
+
+    // Drops the list; Enabled() returns false until the next Reset()
+    void Clear() {
+        fSize = 0;
+        std::vector<PipeCell>().swap(fCells);
+        std::vector<int32_t>().swap(fPositions);
+    }
+
+    bool Enabled() const { return fSize > 0; }
+    int Count() const { return (int)fCells.size(); }
+    PipeCell At(int index) const { return fCells[index]; }
+
+    // Both do nothing while the list is not enabled
+    void Remove(PipeCell cell) {
+        if (!Enabled())
+            return;
+        int32_t& position = fPositions[Index(cell)];
+        if (position < 0)
+            return;
+        PipeCell last = fCells.back();
+        fCells[position] = last;
+        fPositions[Index(last)] = position;
+        fCells.pop_back();
+        position = -1;
+    }
+
+    void Add(PipeCell cell) {
+        if (!Enabled())
+            return;
+        int32_t& position = fPositions[Index(cell)];
+        if (position >= 0)
+            return;
+        position = (int32_t)fCells.size();
+        fCells.push_back(cell);
+    }
+
+private:
+    size_t Index(int x, int y, int z) const {
+        return ((size_t)z * fSize + y) * fSize + x;
+    }
+    size_t Index(PipeCell cell) const {
+        return Index(PipeVolume::CellX(cell), PipeVolume::CellY(cell), PipeVolume::CellZ(cell));
+    }
+
+    int fSize;
+    std::vector<PipeCell> fCells;
+    // Position of each cell in fCells, -1 while it is taken
+    std::vector<int32_t> fPositions;
+};
+
+#endif // FREE_CELL_LIST_H
@@ -0,0 +1,418 @@
+/*
+ * PipeGrowth.cpp
+ *
+ * Growth of the 3D Pipes.
+ */
+
+#include "PipeGrowth.h"
+
+#include <algorithm>
+
+// Pipes are grown on several threads from this many on; the result is the
+// same either way
+static const int kParallelPipeCount = 256;
+// Width of the slabs pipes are grown in, at least three cells
+static const int kSlabWidth = 16;
+
+// Random cells tried when starting a pipe before it waits for the next tick
+static const int kPlacementAttempts = 64;
+
+// Volumes up to this size keep a list of their free cells
+static const int kFreeListMaxSize = 64;
+
+// When finished pipes are kept, the volume starts over once this share of
+// it is taken
+static const float kKeepFinishedFillLimit = 0.5f;
+
+// Routing looks at the 8x8x8 cells around the head, which start this far
+// before it on each axis, and floods them for at most this many steps
+static const int kWindowOffset = 4;
+static const int kFloodSteps = 24;
+
+PipeGrowth::PipeGrowth()
+    : fPipeCount(0), fSceneRandom(0, 0), fKeepFinished(false), fFocused(false),
+      fRecycleDistance(0.0f), fSpawnExtent(0), fThreadCount(0), fStepCount(0),
+      fRestartCount(0) {
+    fCamera[0] = fCamera[1] = fCamera[2] = 0.0f;
+    fSpawn[0] = fSpawn[1] = fSpawn[2] = 0.0f;
+}
+
+void PipeGrowth::Reset(int pipeCount, int volumeSize, uint32_t seed) {
+    fPipeCount = pipeCount;
+    fVolume.SetSize(volumeSize);
+    fSceneRandom.Seed(seed, 0);
+    fStepCount = fRestartCount = 0;
+    Refill();
+}
+
+void PipeGrowth::Refill() {
+    fVolume.Clear();
+    if (fVolume.Size() <= kFreeListMaxSize)
+        fFreeCells.Reset(fVolume.Size());
+    else
+        fFreeCells.Clear();
+    fEvents.clear();
+
+    fPipes.clear();
+    fPipes.reserve(fPipeCount);
+    uint64_t seed = (uint64_t)fSceneRandom.Next() << 32 | fSceneRandom.Next();
+    for (int i = 0; i < fPipeCount; ++i)
+        AddNewPipe(seed);
+}
+
+void PipeGrowth::SetFocus(const float camera[3], float recycleDistance, const float spawn[3],
+        int extent) {
+    fFocused = true;
+    std::copy(camera, camera + 3, fCamera);
+    fRecycleDistance = recycleDistance;
+    std::copy(spawn, spawn + 3, fSpawn);
+    fSpawnExtent = extent;
+}
+
+bool PipeGrowth::Step() {
+    int size = fVolume.Size();
+
+    // Pipes are grown in slabs of kSlabWidth cells along x. A pipe only
+    // reaches the cells next to its head, so pipes in slabs of the same
+    // parity can never compete for a cell; the slabs of one parity are
+    // grown in parallel, each one on a single thread in pipe order. This
+    // makes the result independent of the number of threads and of their
+    // timing. Routing reads the cells up to kWindowOffset away from the
+    // head, which stay within the neighbouring slabs that rest meanwhile.
+    int slabCount = (size + kSlabWidth - 1) / kSlabWidth;
+    fSlabStarts.assign(slabCount + 1, 0);
+
+    for (auto& pipe : fPipes) {
+        pipe.growing = false;
+        if (pipe.cellCount == 0) {
+            PlacePipe(pipe);
+            continue;
+        }
+
+        // Pipes the camera has left behind start over ahead of it
+        if (fFocused) {
+            PipeCell head = pipe.Head();
+            float dx = PipeVolume::CellX(head) - fCamera[0];
+            float dy = PipeVolume::CellY(head) - fCamera[1];
+            float dz = PipeVolume::CellZ(head) - fCamera[2];
+            if (dx * dx + dy * dy + dz * dz > fRecycleDistance * fRecycleDistance) {
+                ReleasePipe(pipe);
+                StartPipe(pipe);
+                continue;
+            }
+        }
+        pipe.growing = true;
+    }
+
+    for (auto& pipe : fPipes) {
+        if (!pipe.growing)
+            continue;
+
+        // Claims cannot add bricks, so add those of all cells the pipe can
+        // reach outside the brick of its head
+        PipeCell head = pipe.Head();
+        int coordinates[3] = { PipeVolume::CellX(head), PipeVolume::CellY(head),
+            PipeVolume::CellZ(head) };
+        for (int axis = 0; axis < 3; ++axis) {
+            PipeCell neighbor;
+            if ((coordinates[axis] & 15) == 15 && fVolume.Neighbor(head, axis * 2, neighbor))
+                fVolume.AddBrick(neighbor);
+            if ((coordinates[axis] & 15) == 0 && fVolume.Neighbor(head, axis * 2 + 1, neighbor))
+                fVolume.AddBrick(neighbor);
+        }
+
+        fSlabStarts[coordinates[0] / kSlabWidth + 1]++;
+    }
+
+    // Sort the growing pipes by slab, in pipe order within each slab
+    int growingCount = 0;
+    for (int slab = 0; slab < slabCount; ++slab) {
+        growingCount += fSlabStarts[slab + 1];
+        fSlabStarts[slab + 1] = growingCount;
+    }
+    fSlabPipes.resize(growingCount);
+    std::vector<int> next(fSlabStarts.begin(), fSlabStarts.end() - 1);
+    for (size_t i = 0; i < fPipes.size(); ++i) {
+        if (fPipes[i].growing)
+            fSlabPipes[next[PipeVolume::CellX(fPipes[i].Head()) / kSlabWidth]++] = i;
+    }
+
+    bool parallel = growingCount >= kParallelPipeCount;
+    if (parallel && fWorkers == nullptr)
+        fWorkers.reset(new WorkerPool(fThreadCount));
+
+    for (int parity = 0; parity < 2; ++parity) {
+        std::vector<int> slabs;
+        for (int slab = parity; slab < slabCount; slab += 2) {
+            if (fSlabStarts[slab + 1] > fSlabStarts[slab])
+                slabs.push_back(slab);
+        }
+
+        auto growSlab = [&](int job) {
+            int slab = slabs[job];
+            for (int i = fSlabStarts[slab]; i < fSlabStarts[slab + 1]; ++i)
+                GrowStep(fPipes[fSlabPipes[i]]);
+        };
+        if (parallel) {
+            fWorkers->Run(slabs.size(), growSlab);
+        } else {
+            for (size_t job = 0; job < slabs.size(); ++job)
+                growSlab(job);
+        }
+    }
+
+    // Everything that adds or removes bricks happens afterwards, in pipe
+    // order again. The cells taken and retired this tick are settled
+    // first, so that restarting pipes only see free cells as free.
+    for (auto& pipe : fPipes) {
+        if (!pipe.growing)
+            continue;
+        if (pipe.grew)
+            fFreeCells.Remove(pipe.Head());
+        if (pipe.retiring) {
+            // The cells of kept pipes stay taken
+            if (!fKeepFinished) {
+                fVolume.Unclaim(pipe.retiredCell);
+                fFreeCells.Add(pipe.retiredCell);
+            }
+            pipe.retiring = false;
+        }
+    }
+
+    for (auto& pipe : fPipes) {
+        if (!pipe.growing)
+            continue;
+
+        if (pipe.grew) {
+            fStepCount++;
+            AddEvent(PipeEvent::kGrew, pipe, pipe.Head());
+            continue;
+        }
+
+        fRestartCount++;
+        // A stuck pipe that is kept stays as it is, and a new one starts at
+        // a free cell; its cells remain taken
+        if (fKeepFinished) {
+            AddEvent(PipeEvent::kFinished, pipe, pipe.Head());
+            StartPipe(pipe);
+            continue;
+        }
+
+        // Otherwise free up its cells and restart it at a new random position
+        ReleasePipe(pipe);
+        PlacePipe(pipe);
+    }
+    fVolume.ReclaimBricks();
+
+    double volumeCells = (double)size * size * size;
+    if (fKeepFinished && fVolume.CountOccupied() >= kKeepFinishedFillLimit * volumeCells) {
+        Refill();
+        return true;
+    }
+    return false;
+}
+
+void PipeGrowth::AddNewPipe(uint64_t seed) {
+    fPipes.emplace_back();
+    fPipes.back().random.Seed(seed, fPipes.size() - 1);
+    StartPipe(fPipes.back());
+}
+
+// Gives the pipe a new color, direction and a free start cell
+void PipeGrowth::StartPipe(Pipe& pipe) {
+    pipe.r = pipe.random.UnitFloat();
+    pipe.g = pipe.random.UnitFloat();
+    pipe.b = pipe.random.UnitFloat();
+    pipe.direction = pipe.random.Uniform(6);
+    pipe.growing = pipe.grew = pipe.retiring = false;
+    PlacePipe(pipe);
+}
+
+// Starts the pipe over at a free cell. If none is found, the pipe stays
+// empty and tries again on the next tick.
+bool PipeGrowth::PlacePipe(Pipe& pipe) {
+    pipe.firstCell = 0;
+    pipe.cellCount = 0;
+
+    PipeCell cell;
+    if (!RandomFreeCell(pipe, cell))
+        return false;
+
+    if (!fVolume.Occupy(cell))
+        return false;
+    fFreeCells.Remove(cell);
+    pipe.cells[0] = cell;
+    pipe.directions[0] = pipe.direction;
+    pipe.cellCount = 1;
+    AddEvent(PipeEvent::kStarted, pipe, cell);
+    return true;
+}
+
+void PipeGrowth::ReleasePipe(Pipe& pipe) {
+    for (int i = 0; i < pipe.cellCount; ++i) {
+        PipeCell cell = pipe.Cell(i);
+        fVolume.Release(cell);
+        fFreeCells.Add(cell);
+    }
+    pipe.cellCount = 0;
+}
+
+// Picks a free cell anywhere in the volume, or around the spawn point when
+// there is a focus. Without one, small volumes can fill up, so their cells
+// come from the free list, where probing might miss the last free ones.
+bool PipeGrowth::RandomFreeCell(Pipe& pipe, PipeCell& cell) const {
+    if (fFreeCells.Enabled() && !fFocused) {
+        if (fFreeCells.Count() == 0)
+            return false;
+        cell = fFreeCells.At(pipe.random.Uniform(fFreeCells.Count()));
+        return true;
+    }
+
+    int size = fVolume.Size();
+    int low[3] = { 0, 0, 0 };
+    int range[3] = { size, size, size };
+    if (fFocused) {
+        for (int axis = 0; axis < 3; ++axis) {
+            int middle = (int)(fSpawn[axis] + 0.5f);
+            low[axis] = std::max(0, middle - fSpawnExtent);
+            range[axis] = std::max(1, std::min(size, middle + fSpawnExtent) - low[axis]);
+        }
+    }
+
+    for (int attempt = 0; attempt < kPlacementAttempts; ++attempt) {
+        int x = low[0] + pipe.random.Uniform(range[0]);
+        int y = low[1] + pipe.random.Uniform(range[1]);
+        int z = low[2] + pipe.random.Uniform(range[2]);
+        cell = PipeVolume::Cell(x, y, z);
+        if (!fVolume.IsOccupied(cell))
+            return true;
+    }
+    return false;
+}
+
+void PipeGrowth::AddEvent(PipeEvent::Type type, const Pipe& pipe, PipeCell cell) {
+    if (!fKeepFinished)
+        return;
+    PipeEvent event = { type, (int)(&pipe - fPipes.data()), cell, pipe.r, pipe.g, pipe.b };
+    fEvents.push_back(event);
+}
+
+// Grows the pipe by one cell if it can. Runs on any thread, see Step().
+void PipeGrowth::GrowStep(Pipe& pipe) {
+    // Keep the current direction unless a random turn (1 in 10 steps) is
+    // due or it is blocked, then let routing pick one
+    bool moved = pipe.random.Uniform(10) != 0 && GrowPipe(pipe, pipe.direction);
+    if (!moved) {
+        int direction = ChooseDirection(pipe);
+        moved = direction >= 0 && GrowPipe(pipe, direction);
+    }
+    pipe.grew = moved;
+}
+
+// Free cells of an 8x8x8 window, as returned by PipeVolume::GetWindow(),
+// that can be reached from the given one, which are left in reached. The
+// reached set grows by a step in all six directions at once, a layer word
+// at a time.
+static int FloodFill(const uint64_t free[8], int x, int y, int z, uint64_t reached[8]) {
+    // Cells on the low and the high x edge of each row
+    const uint64_t kLowEdge = 0x0101010101010101ULL;
+    const uint64_t kHighEdge = 0x8080808080808080ULL;
+
+    std::fill(reached, reached + 8, 0);
+    reached[z] = 1ULL << (x + y * 8);
+    for (int step = 0; step < kFloodSteps; ++step) {
+        uint64_t grown[8];
+        bool changed = false;
+        for (int layer = 0; layer < 8; ++layer) {
+            uint64_t bits = reached[layer];
+            uint64_t next = bits | (bits << 1 & ~kLowEdge) | (bits >> 1 & ~kHighEdge)
+                | bits << 8 | bits >> 8;
+            if (layer > 0)
+                next |= reached[layer - 1];
+            if (layer < 7)
+                next |= reached[layer + 1];
+            grown[layer] = next & free[layer];
+            changed |= grown[layer] != bits;
+        }
+        std::copy(grown, grown + 8, reached);
+        if (!changed)
+            break;
+    }
+
+    int count = 0;
+    for (int layer = 0; layer < 8; ++layer)
+        count += __builtin_popcountll(reached[layer]);
+    return count;
+}
+
+// Picks the free neighbour of the head that leads to the most free space
+// around it, so that pipes keep out of pockets they would get stuck in.
+// Ties, as in open space, are broken at random. Returns -1 if the pipe is
+// boxed in.
+int PipeGrowth::ChooseDirection(Pipe& pipe) const {
+    PipeCell head = pipe.Head();
+    uint64_t free[8];
+    fVolume.GetWindow(PipeVolume::CellX(head) - kWindowOffset,
+        PipeVolume::CellY(head) - kWindowOffset, PipeVolume::CellZ(head) - kWindowOffset, free);
+    for (int layer = 0; layer < 8; ++layer)
+        free[layer] = ~free[layer];
+
+    // Neighbours in a region flooded before share its score, so in open
+    // space a single fill does
+    uint64_t regions[6][8];
+    int regionScores[6];
+    int regionCount = 0;
+
+    int best = -1;
+    int bestScore = 0;
+    int ties = 0;
+    for (int direction = 0; direction < 6; ++direction) {
+        int x = kWindowOffset + kDirections[direction][0];
+        int y = kWindowOffset + kDirections[direction][1];
+        int z = kWindowOffset + kDirections[direction][2];
+        uint64_t bit = 1ULL << (x + y * 8);
+        if (!(free[z] & bit))
+            continue;
+
+        int score = -1;
+        for (int region = 0; region < regionCount && score < 0; ++region) {
+            if (regions[region][z] & bit)
+                score = regionScores[region];
+        }
+        if (score < 0) {
+            score = FloodFill(free, x, y, z, regions[regionCount]);
+            regionScores[regionCount++] = score;
+        }
+        if (score > bestScore) {
+            best = direction;
+            bestScore = score;
+            ties = 1;
+        } else if (score == bestScore && pipe.random.Uniform(++ties) == 0) {
+            best = direction;
+        }
+    }
+    return best;
+}
+
+// Extends the pipe by one cell in the given direction if that cell is free
+bool PipeGrowth::GrowPipe(Pipe& pipe, int direction) {
+    PipeCell next;
+    if (!fVolume.Neighbor(pipe.Head(), direction, next) || !fVolume.Claim(next))
+        return false;
+
+    // A full pipe drops its oldest cell; the cell itself is released after
+    // all pipes have grown
+    if (pipe.cellCount == kMaxSegments) {
+        pipe.retiredCell = pipe.cells[pipe.firstCell];
+        pipe.retiring = true;
+        pipe.firstCell = (pipe.firstCell + 1) % kMaxSegments;
+        pipe.cellCount--;
+    }
+
+    int slot = (pipe.firstCell + pipe.cellCount) % kMaxSegments;
+    pipe.cells[slot] = next;
+    pipe.directions[slot] = direction;
+    pipe.cellCount++;
+    pipe.direction = direction;
+    return true;
+}
@@ -0,0 +1,151 @@
+/*
+ * PipeGrowth.h
+ *
+ * The growth of the 3D Pipes: the pipes, the volume they fill and the rules
+ * they grow by. Every tick, each pipe keeps its direction or turns towards
+ * the most free space around its head, and a pipe that is stuck starts over
+ * at a free cell. Pipes keep their last kMaxSegments cells, unless finished
+ * pipes are kept, in which case the volume starts over once it is filled up.
+ *
+ * Everything random derives from one scene seed, and the result does not
+ * depend on the number of threads the pipes are grown on.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef PIPE_GROWTH_H
+#define PIPE_GROWTH_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "FreeCellList.h"
+#include "PipeRandom.h"
+#include "PipeVolume.h"
+#include "WorkerPool.h"
+
+// Pipes keep at most this many cells; older ones are retired
+const int kMaxSegments = 25;
+
+// Unit vectors of the six growth directions: X+, X-, Y+, Y-, Z+, Z-
+const int kDirections[6][3] = {
+    { 1, 0, 0 }, { -1, 0, 0 },
+    { 0, 1, 0 }, { 0, -1, 0 },
+    { 0, 0, 1 }, { 0, 0, -1 }
+};
+
+struct Pipe {
+    // Ring of the occupied cells, the oldest one at firstCell and the head
+    // at firstCell + cellCount - 1. The pipe grew into cells[i] in
+    // directions[i].
+    PipeCell cells[kMaxSegments];
+    uint8_t directions[kMaxSegments];
+    int firstCell;
+    int cellCount;
+    float r, g, b;
+    int direction;
+    // The pipe's own stream of the scene's random numbers
+    PipeRandom random;
+
+    // Progress of the current tick
+    bool growing;
+    bool grew;
+    bool retiring;
+    PipeCell retiredCell;
+
+    PipeCell Cell(int index) const { return cells[(firstCell + index) % kMaxSegments]; }
+    uint8_t Direction(int index) const { return directions[(firstCell + index) % kMaxSegments]; }
+    PipeCell Head() const { return Cell(cellCount - 1); }
+};
+
+// What happened to a pipe during a tick, recorded while finished pipes are
+// kept
+struct PipeEvent {
+    enum Type {
+        kStarted,   // at cell
+        kGrew,      // into cell
+        kFinished   // stuck at cell, before it starts over
+    };
+
+    Type type;
+    int pipe;
+    PipeCell cell;
+    // Color of the pipe at the time, which a finished pipe changes when
+    // it starts over
+    float r, g, b;
+};
+
+class PipeGrowth {
+public:
+    PipeGrowth();
+
+    // Fills a volume of size^3 cells with pipeCount new pipes
+    void Reset(int pipeCount, int volumeSize, uint32_t seed);
+    // Starts over with new pipes from the next seed of the scene
+    void Refill();
+
+    void SetKeepFinished(bool keep) { fKeepFinished = keep; }
+    // Pipes farther than recycleDistance cells from the camera start over
+    // within extent cells of the spawn point; all coordinates are in cells
+    void SetFocus(const float camera[3], float recycleDistance, const float spawn[3],
+        int extent);
+    void ClearFocus() { fFocused = false; }
+    // 0 uses one thread per CPU; set before the first Step()
+    void SetThreadCount(int count) { fThreadCount = count; }
+
+    // Grows all pipes by a tick. Returns true if the volume started over.
+    bool Step();
+
+    const std::vector<Pipe>& Pipes() const { return fPipes; }
+    const PipeVolume& Volume() const { return fVolume; }
+    const std::vector<PipeEvent>& Events() const { return fEvents; }
+    void ClearEvents() { fEvents.clear(); }
+
+    // Totals since the last Reset()
+    int64_t CountSteps() const { return fStepCount; }
+    int64_t CountRestarts() const { return fRestartCount; }
+    int CountThreads() const { return fWorkers != nullptr ? fWorkers->CountThreads() : 1; }
+
+private:
+    void AddNewPipe(uint64_t seed);
+    void StartPipe(Pipe& pipe);
+    bool PlacePipe(Pipe& pipe);
+    void ReleasePipe(Pipe& pipe);
+    bool RandomFreeCell(Pipe& pipe, PipeCell& cell) const;
+    void AddEvent(PipeEvent::Type type, const Pipe& pipe, PipeCell cell);
+    void GrowStep(Pipe& pipe);
+    int ChooseDirection(Pipe& pipe) const;
+    bool GrowPipe(Pipe& pipe, int direction);
+
+    std::vector<Pipe> fPipes;
+    PipeVolume fVolume;
+    // Only kept for volumes small enough to fill up
+    FreeCellList fFreeCells;
+    int fPipeCount;
+
+    // Every filling of the volume draws a seed from fSceneRandom, and pipe
+    // i of it uses stream i
+    PipeRandom fSceneRandom;
+
+    bool fKeepFinished;
+    std::vector<PipeEvent> fEvents;
+
+    bool fFocused;
+    float fCamera[3];
+    float fRecycleDistance;
+    float fSpawn[3];
+    int fSpawnExtent;
+
+    // Pipes growing this tick sorted by slab, and where each slab starts
+    std::vector<int> fSlabPipes;
+    std::vector<int> fSlabStarts;
+    int fThreadCount;
+    std::unique_ptr<WorkerPool> fWorkers;
+
+    int64_t fStepCount;
+    int64_t fRestartCount;
+};
+
+#endif // PIPE_GROWTH_H
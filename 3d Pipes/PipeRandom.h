@@ -0,0 +1,54 @@
+/*
+ * PipeRandom.h
+ *
+ * Small random number generator for the pipes: PCG32 (XSH RR) after
+ * Melissa O'Neill, with 64 bits of state and a selectable stream. Every
+ * pipe draws from its own stream of one scene seed, so a scene replays
+ * exactly and pipes can grow on any thread without sharing state.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef PIPE_RANDOM_H
+#define PIPE_RANDOM_H
+
+#include <stdint.h>
+
+class PipeRandom {
+public:
+    PipeRandom() { Seed(0, 0); }
+    PipeRandom(uint64_t seed, uint64_t stream) { Seed(seed, stream); }
+
+    void Seed(uint64_t seed, uint64_t stream) {
+        fState = 0;
+        fIncrement = stream << 1 | 1;
+        Next();
+        fState += seed;
+        Next();
+    }
+
+    uint32_t Next() {
+        uint64_t state = fState;
+        fState = state * 6364136223846793005ULL + fIncrement;
+        uint32_t value = (uint32_t)(((state >> 18) ^ state) >> 27);
+        uint32_t rotation = (uint32_t)(state >> 59);
+        return value >> rotation | value << (-rotation & 31);
+    }
+
+    // Uniform in [0, bound), by the upper half of a multiplication rather
+    // than a division
+    uint32_t Uniform(uint32_t bound) {
+        return (uint32_t)(((uint64_t)Next() * bound) >> 32);
+    }
+
+    // Uniform in [0, 1)
+    float UnitFloat() {
+        return (Next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t fState;
+    uint64_t fIncrement;
+};
+
+#endif // PIPE_RANDOM_H
@@ -0,0 +1,252 @@
+/*
+ * PipeVolume.cpp
+ *
+ * Sparse occupancy of the 3D Pipes volume.
+ */
+
+#include "PipeVolume.h"
+
+#include <algorithm>
+
+const PipeCell PipeVolume::kNeighborOffsets[6] = {
+    1, (PipeCell)-1,
+    1 << 10, (PipeCell)-(1 << 10),
+    1 << 20, (PipeCell)-(1 << 20)
+};
+
+// The table starts with 256 slots and is kept at most half full
+static const int kInitialSlotBits = 8;
+
+PipeVolume::PipeVolume()
+    : fSize(0), fSlotBits(0), fUsedSlots(0) {
+    SetSize(20);
+}
+
+void PipeVolume::SetSize(int size) {
+    fSize = size < 1 ? 1 : size > kMaxSize ? kMaxSize : size;
+    Clear();
+}
+
+void PipeVolume::Clear() {
+    // Give the memory of a previous, possibly much fuller volume back
+    std::deque<Brick>().swap(fBricks);
+    std::vector<int>().swap(fFreeBricks);
+    fKeys.clear();
+    fSlots.clear();
+    Rehash(kInitialSlotBits);
+}
+
+bool PipeVolume::IsOccupied(PipeCell cell) const {
+    int index = FindBrick(BrickKey(cell));
+    if (index < 0)
+        return false;
+    int bit = BrickBit(cell);
+    return (fBricks[index].bits[bit >> 6].load(std::memory_order_relaxed) >> (bit & 63)) & 1;
+}
+
+void PipeVolume::GetWindow(int x, int y, int z, uint64_t window[8]) const {
+    // Most rows lie in the brick of the previous one
+    uint32_t key = 0;
+    int index = -1;
+    for (int dz = 0; dz < 8; ++dz) {
+        uint64_t layer = 0;
+        for (int dy = 0; dy < 8; ++dy) {
+            uint64_t row = 0xff;
+            if (y + dy >= 0 && y + dy < fSize && z + dz >= 0 && z + dz < fSize)
+                row = RowBits(x, y + dy, z + dz, key, index);
+            layer |= row << (dy * 8);
+        }
+        window[dz] = layer;
+    }
+}
+
+bool PipeVolume::Occupy(PipeCell cell) {
+    uint32_t key = BrickKey(cell);
+    int index = FindBrick(key);
+    if (index < 0)
+        index = InsertBrick(key);
+    return ClaimBit(fBricks[index], cell);
+}
+
+void PipeVolume::Release(PipeCell cell) {
+    uint32_t key = BrickKey(cell);
+    int index = FindBrick(key);
+    if (index >= 0 && ClearBit(fBricks[index], cell) && fBricks[index].count == 0)
+        RemoveBrick(key);
+}
+
+bool PipeVolume::Claim(PipeCell cell) {
+    int index = FindBrick(BrickKey(cell));
+    return index >= 0 && ClaimBit(fBricks[index], cell);
+}
+
+void PipeVolume::Unclaim(PipeCell cell) {
+    int index = FindBrick(BrickKey(cell));
+    if (index >= 0)
+        ClearBit(fBricks[index], cell);
+}
+
+void PipeVolume::AddBrick(PipeCell cell) {
+    uint32_t key = BrickKey(cell);
+    if (FindBrick(key) < 0)
+        InsertBrick(key);
+}
+
+void PipeVolume::ReclaimBricks() {
+    std::vector<uint32_t> empty;
+    for (size_t slot = 0; slot < fKeys.size(); ++slot) {
+        if (fKeys[slot] != 0 && fBricks[fSlots[slot]].count == 0)
+            empty.push_back(fKeys[slot]);
+    }
+    for (uint32_t key : empty)
+        RemoveBrick(key);
+}
+
+int64_t PipeVolume::CountOccupied() const {
+    // Recycled bricks are empty
+    int64_t count = 0;
+    for (const Brick& brick : fBricks)
+        count += brick.count.load(std::memory_order_relaxed);
+    return count;
+}
+
+size_t PipeVolume::MemoryUsage() const {
+    return fBricks.size() * sizeof(Brick)
+        + fFreeBricks.capacity() * sizeof(int)
+        + fKeys.capacity() * sizeof(uint32_t)
+        + fSlots.capacity() * sizeof(int);
+}
+
+// Eight cells of a row of the volume from x on, as in GetWindow(). key and
+// index remember the brick looked up last.
+uint32_t PipeVolume::RowBits(int x, int y, int z, uint32_t& key, int& index) const {
+    uint32_t bits = 0;
+    for (int i = 0; i < 8;) {
+        int cellX = x + i;
+        if (cellX < 0 || cellX >= fSize) {
+            bits |= 1u << i++;
+            continue;
+        }
+
+        // The rest of the row within this brick is in one of its words
+        int run = std::min(std::min(8 - i, 16 - (cellX & 15)), fSize - cellX);
+        PipeCell cell = Cell(cellX, y, z);
+        if (BrickKey(cell) != key) {
+            key = BrickKey(cell);
+            index = FindBrick(key);
+        }
+        if (index >= 0) {
+            int bit = BrickBit(cell);
+            uint64_t word = fBricks[index].bits[bit >> 6].load(std::memory_order_relaxed);
+            bits |= (uint32_t)(word >> (bit & 63) & ((1u << run) - 1)) << i;
+        }
+        i += run;
+    }
+    return bits;
+}
+
+bool PipeVolume::ClaimBit(Brick& brick, PipeCell cell) {
+    int bit = BrickBit(cell);
+    std::atomic<uint64_t>& word = brick.bits[bit >> 6];
+    uint64_t mask = (uint64_t)1 << (bit & 63);
+    uint64_t value = word.load(std::memory_order_relaxed);
+    do {
+        if (value & mask)
+            return false;
+    } while (!word.compare_exchange_weak(value, value | mask, std::memory_order_acq_rel,
+        std::memory_order_relaxed));
+    brick.count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool PipeVolume::ClearBit(Brick& brick, PipeCell cell) {
+    int bit = BrickBit(cell);
+    uint64_t mask = (uint64_t)1 << (bit & 63);
+    if (!(brick.bits[bit >> 6].fetch_and(~mask, std::memory_order_acq_rel) & mask))
+        return false;
+    brick.count.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+int PipeVolume::FindBrick(uint32_t key) const {
+    uint32_t mask = (1u << fSlotBits) - 1;
+    for (uint32_t slot = HomeSlot(key); fKeys[slot] != 0; slot = (slot + 1) & mask) {
+        if (fKeys[slot] == key)
+            return fSlots[slot];
+    }
+    return -1;
+}
+
+int PipeVolume::InsertBrick(uint32_t key) {
+    if ((fUsedSlots + 1) * 2 > (1 << fSlotBits))
+        Rehash(fSlotBits + 1);
+
+    int index;
+    if (!fFreeBricks.empty()) {
+        index = fFreeBricks.back();
+        fFreeBricks.pop_back();
+    } else {
+        index = (int)fBricks.size();
+        fBricks.emplace_back();
+    }
+    Brick& brick = fBricks[index];
+    for (int i = 0; i < 64; ++i)
+        brick.bits[i].store(0, std::memory_order_relaxed);
+    brick.count.store(0, std::memory_order_relaxed);
+
+    uint32_t mask = (1u << fSlotBits) - 1;
+    uint32_t slot = HomeSlot(key);
+    while (fKeys[slot] != 0)
+        slot = (slot + 1) & mask;
+    fKeys[slot] = key;
+    fSlots[slot] = index;
+    fUsedSlots++;
+    return index;
+}
+
+void PipeVolume::RemoveBrick(uint32_t key) {
+    uint32_t mask = (1u << fSlotBits) - 1;
+    uint32_t slot = HomeSlot(key);
+    while (fKeys[slot] != key)
+        slot = (slot + 1) & mask;
+
+    fFreeBricks.push_back(fSlots[slot]);
+    fUsedSlots--;
+
+    // Shift later entries of the probe sequence back into the hole, so
+    // lookups never need tombstones
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & mask; fKeys[next] != 0; next = (next + 1) & mask) {
+        uint32_t home = HomeSlot(fKeys[next]);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            fKeys[hole] = fKeys[next];
+            fSlots[hole] = fSlots[next];
+            hole = next;
+        }
+    }
+    fKeys[hole] = 0;
+}
+
+void PipeVolume::Rehash(int slotBits) {
+    std::vector<uint32_t> keys;
+    std::vector<int> slots;
+    keys.swap(fKeys);
+    slots.swap(fSlots);
+
+    fSlotBits = slotBits;
+    fKeys.assign(1u << slotBits, 0);
+    fSlots.assign(1u << slotBits, -1);
+    fUsedSlots = 0;
+
+    uint32_t mask = (1u << fSlotBits) - 1;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (keys[i] == 0)
+            continue;
+        uint32_t slot = HomeSlot(keys[i]);
+        while (fKeys[slot] != 0)
+            slot = (slot + 1) & mask;
+        fKeys[slot] = keys[i];
+        fSlots[slot] = slots[i];
+        fUsedSlots++;
+    }
+}
@@ -0,0 +1,130 @@
+/*
+ * PipeVolume.h
+ *
+ * Sparse occupancy of the cubic volume the pipes grow in. The volume is
+ * split into bricks of 16^3 cells, one bit per cell, which are allocated
+ * when their first cell is taken and recycled when their last one is
+ * released. Bricks are found through an open-addressing hash table keyed
+ * by the brick coordinates, so memory use follows the number of occupied
+ * cells rather than the size of the volume.
+ *
+ * Cells can also be claimed and released from several threads at once with
+ * compare-and-swap on the brick words, as long as no other thread adds or
+ * removes bricks meanwhile.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef PIPE_VOLUME_H
+#define PIPE_VOLUME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+// A cell packs its x, y and z coordinate into 10 bits each
+typedef uint32_t PipeCell;
+
+class PipeVolume {
+public:
+    static const int kMaxSize = 1024;
+
+    PipeVolume();
+
+    // Sets the number of cells along each axis and releases all cells
+    void SetSize(int size);
+    int Size() const { return fSize; }
+    void Clear();
+
+    static PipeCell Cell(int x, int y, int z) { return x | y << 10 | z << 20; }
+    static int CellX(PipeCell cell) { return cell & 1023; }
+    static int CellY(PipeCell cell) { return cell >> 10 & 1023; }
+    static int CellZ(PipeCell cell) { return cell >> 20 & 1023; }
+
+    // Bricks are cubes of kBrickSize cells. The number of a brick packs its
+    // coordinates, the cell coordinates divided by kBrickSize, into 6 bits
+    // each.
+    static const int kBrickSize = 16;
+    static uint32_t BrickNumber(PipeCell cell) { return BrickKey(cell) - 1; }
+
+    // Neighbour of the cell in one of the six directions X+, X-, Y+, Y-,
+    // Z+ and Z-. Returns false if it lies outside the volume.
+    bool Neighbor(PipeCell cell, int direction, PipeCell& neighbor) const {
+        int shift = (direction >> 1) * 10;
+        int coordinate = cell >> shift & 1023;
+        if (direction & 1) {
+            if (coordinate == 0)
+                return false;
+        } else if (coordinate == fSize - 1)
+            return false;
+        neighbor = cell + kNeighborOffsets[direction];
+        return true;
+    }
+
+    bool IsOccupied(PipeCell cell) const;
+    // Occupancy of the 8x8x8 cells from x, y, z on, as one word per z
+    // layer with bit x + 8 * y of the window set for a taken cell. Cells
+    // outside the volume count as taken. Safe alongside Claim().
+    void GetWindow(int x, int y, int z, uint64_t window[8]) const;
+    // Takes a free cell; returns false if it was already taken
+    bool Occupy(PipeCell cell);
+    void Release(PipeCell cell);
+
+    // Lock-free variants of Occupy() and Release(). They never add or
+    // remove bricks: the brick of a claimed cell must have been added
+    // before, and bricks emptied by Unclaim() stay until ReclaimBricks().
+    bool Claim(PipeCell cell);
+    void Unclaim(PipeCell cell);
+    // These two must not run concurrently with anything else
+    void AddBrick(PipeCell cell);
+    void ReclaimBricks();
+
+    int64_t CountOccupied() const;
+    int CountBricks() const { return (int)(fBricks.size() - fFreeBricks.size()); }
+    // Bytes allocated for bricks and the hash table
+    size_t MemoryUsage() const;
+
+private:
+    struct Brick {
+        std::atomic<uint64_t> bits[64];
+        std::atomic<int> count;
+    };
+
+    static const PipeCell kNeighborOffsets[6];
+
+    static uint32_t BrickKey(PipeCell cell) {
+        // Brick coordinates take 6 bits each; 0 marks an empty slot
+        return ((cell >> 4 & 63) | (cell >> 14 & 63) << 6 | (cell >> 24 & 63) << 12) + 1;
+    }
+    static int BrickBit(PipeCell cell) {
+        return (cell & 15) | (cell >> 10 & 15) << 4 | (cell >> 20 & 15) << 8;
+    }
+
+    uint32_t HomeSlot(uint32_t key) const {
+        return (key * 2654435761u) >> (32 - fSlotBits);
+    }
+    int FindBrick(uint32_t key) const;
+    int InsertBrick(uint32_t key);
+    void RemoveBrick(uint32_t key);
+    uint32_t RowBits(int x, int y, int z, uint32_t& key, int& index) const;
+    bool ClaimBit(Brick& brick, PipeCell cell);
+    bool ClearBit(Brick& brick, PipeCell cell);
+    void Rehash(int slotBits);
+
+    int fSize;
+
+    // Hash table of brick keys and their index in fBricks
+    std::vector<uint32_t> fKeys;
+    std::vector<int> fSlots;
+    int fSlotBits;
+    int fUsedSlots;
+
+    // A deque, as bricks can neither be copied nor moved
+    std::deque<Brick> fBricks;
+    std::vector<int> fFreeBricks;
+};
+
+#endif // PIPE_VOLUME_H
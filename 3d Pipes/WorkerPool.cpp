@@ -0,0 +1,76 @@
+/*
+ * WorkerPool.cpp
+ *
+ * Thread pool for the 3D Pipes growth.
+ */
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(int threadCount)
+    : fJob(nullptr), fJobCount(0), fNextJob(0), fActiveThreads(0), fGeneration(0),
+      fQuit(false) {
+    if (threadCount <= 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < threadCount; ++i)
+        fThreads.push_back(std::thread(&WorkerPool::WorkerLoop, this));
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(fLock);
+        fQuit = true;
+    }
+    fStart.notify_all();
+    for (auto& thread : fThreads)
+        thread.join();
+}
+
+void WorkerPool::Run(int count, const std::function<void(int)>& job) {
+    if (fThreads.empty() || count <= 1) {
+        for (int i = 0; i < count; ++i)
+            job(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(fLock);
+        fJob = &job;
+        fJobCount = count;
+        fNextJob = 0;
+        fActiveThreads = (int)fThreads.size();
+        fGeneration++;
+    }
+    fStart.notify_all();
+
+    RunJobs();
+
+    std::unique_lock<std::mutex> lock(fLock);
+    fDone.wait(lock, [this] { return fActiveThreads == 0; });
+    fJob = nullptr;
+}
+
+void WorkerPool::WorkerLoop() {
+    unsigned generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(fLock);
+            fStart.wait(lock, [&] { return fQuit || fGeneration != generation; });
+            if (fQuit)
+                return;
+            generation = fGeneration;
+        }
+
+        RunJobs();
+
+        std::lock_guard<std::mutex> lock(fLock);
+        if (--fActiveThreads == 0)
+            fDone.notify_one();
+    }
+}
+
+void WorkerPool::RunJobs() {
+    for (int index; (index = fNextJob.fetch_add(1)) < fJobCount;)
+        (*fJob)(index);
+}
@@ -0,0 +1,48 @@
+/*
+ * WorkerPool.h
+ *
+ * A small pool of threads that run numbered jobs in parallel. The calling
+ * thread takes part, and Run() returns once every job has finished.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+    // A thread count of 0 uses one thread per CPU
+    explicit WorkerPool(int threadCount = 0);
+    ~WorkerPool();
+
+    int CountThreads() const { return (int)fThreads.size() + 1; }
+
+    // Calls job(index) for every index in [0, count), in no particular
+    // order and on any thread
+    void Run(int count, const std::function<void(int)>& job);
+
+private:
+    void WorkerLoop();
+    void RunJobs();
+
+    std::vector<std::thread> fThreads;
+    std::mutex fLock;
+    std::condition_variable fStart;
+    std::condition_variable fDone;
+    const std::function<void(int)>* fJob;
+    int fJobCount;
+    std::atomic<int> fNextJob;
+    int fActiveThreads;
+    unsigned fGeneration;
+    bool fQuit;
+};
+
+#endif // WORKER_POOL_H
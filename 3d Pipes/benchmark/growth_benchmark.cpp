@@ -0,0 +1,125 @@
+/*
+ * growth_benchmark.cpp
+ *
+ * Growth benchmark for the 3D Pipes on Linux. Steps the growth engine of
+ * the screen saver for a fixed number of ticks and reports the growth steps
+ * per second, the share of the volume that is filled, the number of pipes
+ * that got stuck and started over, the memory used per occupied cell and a
+ * checksum of the final state. With the same options the checksum is the
+ * same for any number of threads, so growth policy changes can be measured
+ * and checked without a display.
+ *
+ * Usage: growth_benchmark [-s size] [-p pipes] [-t ticks] [-S seed]
+ *            [-j threads] [-k]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PipeGrowth.h"
+
+static double elapsed_ms(clockid_t clock, const timespec& start) {
+    timespec now;
+    clock_gettime(clock, &now);
+    return (now.tv_sec - start.tv_sec) * 1000.0
+        + (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+// FNV-1a over the cells and directions of all pipes, in pipe order
+static uint64_t state_checksum(const PipeGrowth& growth) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const Pipe& pipe : growth.Pipes()) {
+        for (int i = 0; i < pipe.cellCount; ++i) {
+            uint64_t value = (uint64_t)pipe.Cell(i) << 8 | pipe.Direction(i);
+            for (int byte = 0; byte < 5; ++byte) {
+                hash ^= (value >> (byte * 8)) & 0xff;
+                hash *= 1099511628211ULL;
+            }
+        }
+        hash ^= 0xff;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-s size] [-p pipes] [-t ticks] [-S seed] [-j threads] [-k]\n",
+        name);
+}
+
+int main(int argc, char** argv) {
+    int size = 1024;
+    int pipeCount = 5000;
+    int ticks = 2000;
+    unsigned seed = 1;
+    int threads = 0;
+    bool keepFinished = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:p:t:S:j:kh")) != -1) {
+        switch (option) {
+            case 's':
+                size = atoi(optarg);
+                break;
+            case 'p':
+                pipeCount = atoi(optarg);
+                break;
+            case 't':
+                ticks = atoi(optarg);
+                break;
+            case 'S':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'k':
+                keepFinished = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (size < 1 || size > PipeVolume::kMaxSize || pipeCount < 1 || ticks < 1
+        || threads < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    PipeGrowth growth;
+    growth.SetThreadCount(threads);
+    growth.SetKeepFinished(keepFinished);
+    growth.Reset(pipeCount, size, seed);
+
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int refills = 0;
+    for (int tick = 0; tick < ticks; ++tick) {
+        if (growth.Step())
+            refills++;
+    }
+
+    double wallTime = elapsed_ms(CLOCK_MONOTONIC, start);
+    const PipeVolume& volume = growth.Volume();
+    int64_t occupied = volume.CountOccupied();
+    double cells = (double)size * size * size;
+
+    printf("volume: %d^3 cells, %d pipes, %d ticks, seed %u%s\n", size, pipeCount, ticks,
+        seed, keepFinished ? ", finished pipes kept" : "");
+    printf("threads: %d\n", growth.CountThreads());
+    printf("steps: %lld in %.1f ms\n", (long long)growth.CountSteps(), wallTime);
+    printf("steps/s: %.0f\n", growth.CountSteps() * 1000.0 / wallTime);
+    printf("restarts: %lld\n", (long long)growth.CountRestarts());
+    if (keepFinished)
+        printf("refills: %d\n", refills);
+    printf("fill: %lld cells, %.4f%%\n", (long long)occupied, occupied * 100.0 / cells);
+    printf("memory: %zu bytes in %d bricks, %.1f bytes/occupied cell\n", volume.MemoryUsage(),
+        volume.CountBricks(), occupied > 0 ? (double)volume.MemoryUsage() / occupied : 0.0);
+    printf("checksum: %016llx\n", (unsigned long long)state_checksum(growth));
+    return 0;
+}
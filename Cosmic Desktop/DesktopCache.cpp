@@ -0,0 +1,130 @@
+/*
+ * DesktopCache.cpp
+ *
+ * Shared screen textures for the Cosmic Desktop screen saver.
+ */
+
+#include "DesktopCache.h"
+
+#include <stdio.h>
+
+
+static const uint64_t kHashBasis = 14695981039346656037ULL;
+static const uint64_t kHashPrime = 1099511628211ULL;
+
+
+DesktopCache::DesktopCache()
+{
+}
+
+
+DesktopCache&
+DesktopCache::Default()
+{
+	static DesktopCache cache;
+	return cache;
+}
+
+
+void
+DesktopCache::SetDirectory(const char* path)
+{
+	std::lock_guard<std::mutex> lock(fLock);
+	fDirectory = path != NULL ? path : "";
+}
+
+
+DesktopCache::TextureRef
+DesktopCache::Get(int32_t screen, uint64_t hash, int maxWidth, int maxHeight,
+	const Builder& builder)
+{
+	std::shared_ptr<Entry> entry;
+	std::unique_lock<std::mutex> building;
+	{
+		std::lock_guard<std::mutex> lock(fLock);
+		size_t index = 0;
+		while (index < fEntries.size() && fEntries[index]->screen != screen)
+			index++;
+
+		if (index < fEntries.size() && fEntries[index]->hash == hash
+			&& fEntries[index]->maxWidth >= maxWidth
+			&& fEntries[index]->maxHeight >= maxHeight) {
+			entry = fEntries[index];
+		} else {
+			entry.reset(new Entry);
+			entry->screen = screen;
+			entry->hash = hash;
+			entry->maxWidth = maxWidth;
+			entry->maxHeight = maxHeight;
+			// Locked before anyone else can find it
+			building = std::unique_lock<std::mutex>(entry->lock);
+			if (index < fEntries.size())
+				fEntries[index] = entry;
+			else
+				fEntries.push_back(entry);
+		}
+	}
+
+	if (!building.owns_lock()) {
+		std::lock_guard<std::mutex> wait(entry->lock);
+		return entry->texture;
+	}
+
+	// The file of an earlier run will do if it was written for the same
+	// content and at least the same size; otherwise it is replaced, since
+	// the content it holds is gone, or it is too small
+	DesktopTexture* texture = new DesktopTexture;
+	std::string path = _FilePath(screen);
+	if (path.empty() || !texture->MapFile(path.c_str(), hash)
+		|| texture->MaxWidth() < maxWidth
+		|| texture->MaxHeight() < maxHeight) {
+		texture->Clear();
+		builder(*texture);
+		if (!path.empty() && texture->CountLevels() > 0)
+			texture->WriteFile(path.c_str(), hash);
+	}
+	entry->texture.reset(texture);
+
+	// A failed capture is not kept, so that the next view tries again
+	if (texture->CountLevels() == 0) {
+		std::lock_guard<std::mutex> lock(fLock);
+		for (size_t i = 0; i < fEntries.size(); i++) {
+			if (fEntries[i] == entry) {
+				fEntries.erase(fEntries.begin() + i);
+				break;
+			}
+		}
+	}
+	return entry->texture;
+}
+
+
+std::string
+DesktopCache::_FilePath(int32_t screen)
+{
+	std::lock_guard<std::mutex> lock(fLock);
+	if (fDirectory.empty())
+		return std::string();
+
+	char name[32];
+	snprintf(name, sizeof(name), "/screen-%d", (int)screen);
+	return fDirectory + name;
+}
+
+
+uint64_t
+DesktopCache::HashStart(int width, int height)
+{
+	return (kHashBasis ^ ((uint64_t)width << 32 | (uint32_t)height))
+		* kHashPrime;
+}
+
+
+// FNV-1a over whole pixels rather than bytes
+uint64_t
+DesktopCache::HashPixels(uint64_t hash, const uint32_t* pixels, int count)
+{
+	for (int i = 0; i < count; i++)
+		hash = (hash ^ (pixels[i] & 0x00ffffff)) * kHashPrime;
+	return hash;
+}
@@ -0,0 +1,82 @@
+/*
+ * DesktopCache.h
+ *
+ * The textures of the captured screens, shared by all views of the screen
+ * saver in the process and kept from one run of it to the next. A texture
+ * is looked up by its screen and a hash of a sparse sample of the screen's
+ * pixels: when the sample has not changed, the texture built before still
+ * shows the screen and it is not captured again. Textures are reference
+ * counted, so that a view can go on using one after the cache dropped it
+ * for newer content. With a directory set, the texture of every screen is
+ * also written to a file there, which the next process to run the screen
+ * saver maps instead of capturing the screen again.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef DESKTOP_CACHE_H
+#define DESKTOP_CACHE_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DesktopTexture.h"
+
+class DesktopCache {
+public:
+			typedef std::shared_ptr<const DesktopTexture> TextureRef;
+			// Captures the screen into the texture, for at most the size
+			// passed to Get()
+			typedef std::function<void(DesktopTexture& texture)> Builder;
+
+								DesktopCache();
+
+	static	DesktopCache&		Default();
+
+			// Where the texture files are kept; none are without one.
+			void				SetDirectory(const char* path);
+
+			// Returns the texture of the screen with the content of the
+			// hash, built for at least maxWidth x maxHeight. If there is
+			// none, it is built with builder, and others asking for it
+			// meanwhile wait for it rather than capture the screen as
+			// well. The cache keeps one texture per screen.
+			TextureRef			Get(int32_t screen, uint64_t hash,
+									int maxWidth, int maxHeight,
+									const Builder& builder);
+
+			// Folds count pixels of the sample into hash; start with the
+			// result of HashStart() for the size of the screen. The alpha
+			// channel is left out.
+	static	uint64_t			HashStart(int width, int height);
+	static	uint64_t			HashPixels(uint64_t hash,
+									const uint32_t* pixels, int count);
+
+private:
+			struct Entry {
+				int32_t			screen;
+				uint64_t		hash;
+				int				maxWidth;
+				int				maxHeight;
+				// Held while the texture is built
+				std::mutex		lock;
+				TextureRef		texture;
+			};
+
+								DesktopCache(const DesktopCache&);
+			DesktopCache&		operator=(const DesktopCache&);
+
+			// Of the texture file of the screen, or empty
+			std::string			_FilePath(int32_t screen);
+
+			std::mutex			fLock;
+			std::string			fDirectory;
+			std::vector<std::shared_ptr<Entry> > fEntries;
+};
+
+#endif // DESKTOP_CACHE_H
@@ -0,0 +1,479 @@
+/*
+ * DesktopTexture.cpp
+ *
+ * Downscaling, mipmap building and texture files for the Cosmic Desktop
+ * screen saver.
+ */
+
+#include "DesktopTexture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Filter weights of a resampled pixel add up to this
+static const int kWeightBits = 14;
+// Fractional bits of the channels between the two passes of the filter
+static const int kFractionBits = 7;
+static const uint32_t kAlphaMask = 0xff000000;
+
+// Texture files start with this header, which the pixels of all levels
+// follow in the order they have in memory. Files are only ever read back
+// on the machine that wrote them, so the fields are in its byte order.
+struct FileHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	key;
+	int32_t		maxWidth;
+	int32_t		maxHeight;
+	// Of level 0, from which the other levels follow
+	int32_t		width;
+	int32_t		height;
+	// Of the pixels of all levels
+	uint64_t	checksum;
+};
+
+static const uint32_t kFileMagic = 0x43447478;	// "CDtx"
+static const uint32_t kFileVersion = 2;
+// Larger sizes in a file are taken for damage
+static const int32_t kMaxFileSize = 65536;
+
+
+// Rounded average of four pixels, two channels at a time in 16-bit lanes
+static inline uint32_t
+AveragePixels(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	const uint32_t mask = 0x00ff00ff;
+	uint32_t low = (a & mask) + (b & mask) + (c & mask) + (d & mask)
+		+ 0x00020002;
+	uint32_t high = (a >> 8 & mask) + (b >> 8 & mask) + (c >> 8 & mask)
+		+ (d >> 8 & mask) + 0x00020002;
+	return (low >> 2 & mask) | (high >> 2 & mask) << 8;
+}
+
+
+// The source pixels of a resampled row or column: each target pixel is the
+// average of the source pixels its area covers, weighted by how much of
+// them it covers.
+struct FilterTaps {
+	std::vector<int>		first;
+	std::vector<int>		count;
+	std::vector<int>		weightStart;
+	std::vector<uint32_t>	weights;
+
+	void Build(int size, int targetSize)
+	{
+		first.resize(targetSize);
+		count.resize(targetSize);
+		weightStart.resize(targetSize);
+		weights.clear();
+
+		// In units of 1 / (size * targetSize) of the row, a target pixel
+		// spans size units and a source pixel targetSize units
+		for (int i = 0; i < targetSize; i++) {
+			int64_t start = (int64_t)i * size;
+			int64_t end = start + size;
+			int j = (int)(start / targetSize);
+			first[i] = j;
+			weightStart[i] = (int)weights.size();
+
+			uint32_t total = 0;
+			for (; j < size && (int64_t)j * targetSize < end; j++) {
+				int64_t overlap = std::min(end, (int64_t)(j + 1) * targetSize)
+					- std::max(start, (int64_t)j * targetSize);
+				uint32_t weight = (uint32_t)((overlap << kWeightBits) / size);
+				weights.push_back(weight);
+				total += weight;
+			}
+			count[i] = (int)weights.size() - weightStart[i];
+			// Rounding leftovers go to the first tap
+			weights[weightStart[i]] += (1 << kWeightBits) - total;
+		}
+	}
+};
+
+
+// Writes all of size bytes, however many calls that takes
+static bool
+WriteAll(int fd, const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0) {
+		ssize_t written = write(fd, bytes, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+
+// Multiplicative hash of the pixels in four independent lanes, so that
+// checking a mapped file takes little more than reading it
+static uint64_t
+ChecksumPixels(const uint32_t* pixels, size_t count)
+{
+	const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+	uint64_t lanes[4] = { 1, 2, 3, 4 };
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		for (int lane = 0; lane < 4; lane++)
+			lanes[lane] = (lanes[lane] ^ pixels[i + lane]) * prime;
+	}
+	for (; i < count; i++)
+		lanes[0] = (lanes[0] ^ pixels[i]) * prime;
+
+	uint64_t checksum = count;
+	for (int lane = 0; lane < 4; lane++)
+		checksum = (checksum ^ lanes[lane] ^ lanes[lane] >> 29) * prime;
+	return checksum;
+}
+
+
+DesktopTexture::DesktopTexture()
+	:
+	fBits(NULL),
+	fPixelCount(0),
+	fMapping(NULL),
+	fMappingSize(0),
+	fMaxWidth(0),
+	fMaxHeight(0)
+{
+}
+
+
+DesktopTexture::~DesktopTexture()
+{
+	Clear();
+}
+
+
+void
+DesktopTexture::Build(const void* bits, int width, int height,
+	int bytesPerRow, int maxWidth, int maxHeight)
+{
+	Clear();
+	if (bits == NULL || width < 1 || height < 1)
+		return;
+
+	float scale = std::min(1.0f, std::min((float)maxWidth / width,
+		(float)maxHeight / height));
+	int targetWidth = std::max(1, (int)(width * scale + 0.5f));
+	int targetHeight = std::max(1, (int)(height * scale + 0.5f));
+
+	_AddLevels(targetWidth, targetHeight);
+	fPixels.resize(fPixelCount);
+	fBits = &fPixels[0];
+	fMaxWidth = maxWidth;
+	fMaxHeight = maxHeight;
+
+	// Halving is cheap and filters well, so the capture is halved until it
+	// is less than twice the size of level 0, which the area filter then
+	// scales it to
+	const uint32_t* source = (const uint32_t*)bits;
+	size_t stride = bytesPerRow / sizeof(uint32_t);
+	std::vector<uint32_t> halved[2];
+	for (int i = 0; width >= 2 * targetWidth && height >= 2 * targetHeight;
+			i ^= 1) {
+		halved[i].resize((size_t)(width / 2) * (height / 2));
+		_Halve(source, width, height, stride, &halved[i][0]);
+		width /= 2;
+		height /= 2;
+		stride = width;
+		source = &halved[i][0];
+	}
+	_Resample(source, width, height, stride, &fPixels[0], targetWidth,
+		targetHeight);
+
+	for (size_t i = 1; i < fLevels.size(); i++) {
+		const Level& above = fLevels[i - 1];
+		_Halve(&fPixels[above.offset], above.width, above.height,
+			above.width, &fPixels[fLevels[i].offset]);
+	}
+}
+
+
+void
+DesktopTexture::Clear()
+{
+	if (fMapping != NULL)
+		munmap(fMapping, fMappingSize);
+	fMapping = NULL;
+	fMappingSize = 0;
+	fPixels.clear();
+	fLevels.clear();
+	fBits = NULL;
+	fPixelCount = 0;
+	fMaxWidth = 0;
+	fMaxHeight = 0;
+}
+
+
+bool
+DesktopTexture::WriteFile(const char* path, uint64_t key) const
+{
+	if (fLevels.empty())
+		return false;
+
+	FileHeader header = { kFileMagic, kFileVersion, key, fMaxWidth,
+		fMaxHeight, Width(), Height(), ChecksumPixels(fBits, fPixelCount) };
+
+	// Whoever maps the file meanwhile keeps seeing the old one. Every
+	// writer has a file of its own, which only its user can read, since it
+	// holds what was on the screen.
+	std::string temporaryPath = std::string(path) + ".XXXXXX";
+	int fd = mkstemp(&temporaryPath[0]);
+	if (fd < 0)
+		return false;
+	bool written = WriteAll(fd, &header, sizeof(header))
+		&& WriteAll(fd, fBits, Size());
+	if (close(fd) != 0)
+		written = false;
+
+	if (written && rename(temporaryPath.c_str(), path) == 0)
+		return true;
+	unlink(temporaryPath.c_str());
+	return false;
+}
+
+
+bool
+DesktopTexture::MapFile(const char* path, uint64_t key)
+{
+	Clear();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	void* mapping = MAP_FAILED;
+	size_t size = 0;
+	if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(FileHeader)) {
+		size = info.st_size;
+		mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	// The mapping stays valid without the file descriptor
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return false;
+
+	const FileHeader* header = (const FileHeader*)mapping;
+	if (header->magic == kFileMagic && header->version == kFileVersion
+		&& header->key == key && header->width >= 1 && header->height >= 1
+		&& header->width <= kMaxFileSize && header->height <= kMaxFileSize) {
+		_AddLevels(header->width, header->height);
+	}
+	if (fLevels.empty()
+		|| size != sizeof(FileHeader) + fPixelCount * sizeof(uint32_t)
+		|| ChecksumPixels((const uint32_t*)(header + 1), fPixelCount)
+			!= header->checksum) {
+		munmap(mapping, size);
+		Clear();
+		return false;
+	}
+
+	fMapping = mapping;
+	fMappingSize = size;
+	fBits = (const uint32_t*)(header + 1);
+	fMaxWidth = header->maxWidth;
+	fMaxHeight = header->maxHeight;
+	return true;
+}
+
+
+// The levels share one block, level 0 first
+void
+DesktopTexture::_AddLevels(int width, int height)
+{
+	fPixelCount = 0;
+	for (;; width = std::max(1, width / 2), height = std::max(1, height / 2)) {
+		Level level = { width, height, fPixelCount };
+		fLevels.push_back(level);
+		fPixelCount += (size_t)width * height;
+		if (width == 1 && height == 1)
+			break;
+	}
+}
+
+
+// Averages every 2 x 2 block of the source into one target pixel. An odd
+// last row or column is left out, and a single one is averaged with itself.
+void
+DesktopTexture::_Halve(const uint32_t* source, int width, int height,
+	size_t stride, uint32_t* target)
+{
+	int targetWidth = std::max(1, width / 2);
+	int targetHeight = std::max(1, height / 2);
+
+	for (int y = 0; y < targetHeight; y++) {
+		const uint32_t* top = source + (size_t)(2 * y) * stride;
+		const uint32_t* bottom = source
+			+ (size_t)std::min(2 * y + 1, height - 1) * stride;
+		uint32_t* row = target + (size_t)y * targetWidth;
+
+		if (width == 1) {
+			row[0] = AveragePixels(top[0], top[0], bottom[0], bottom[0]);
+			continue;
+		}
+
+		int x = 0;
+#if defined(__SSE2__)
+		// Four target pixels from eight pixels of each source row, with
+		// the sums kept in 16-bit lanes
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi16(2);
+		for (; x + 4 <= targetWidth; x += 4) {
+			__m128i top0 = _mm_loadu_si128((const __m128i*)(top + 2 * x));
+			__m128i top1 = _mm_loadu_si128((const __m128i*)(top + 2 * x + 4));
+			__m128i bottom0 = _mm_loadu_si128(
+				(const __m128i*)(bottom + 2 * x));
+			__m128i bottom1 = _mm_loadu_si128(
+				(const __m128i*)(bottom + 2 * x + 4));
+
+			// Columns 0 and 1, 2 and 3 of both rows
+			__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top0, zero),
+				_mm_unpacklo_epi8(bottom0, zero));
+			__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top0, zero),
+				_mm_unpackhi_epi8(bottom0, zero));
+			__m128i first = _mm_add_epi16(_mm_unpacklo_epi64(low, high),
+				_mm_unpackhi_epi64(low, high));
+
+			low = _mm_add_epi16(_mm_unpacklo_epi8(top1, zero),
+				_mm_unpacklo_epi8(bottom1, zero));
+			high = _mm_add_epi16(_mm_unpackhi_epi8(top1, zero),
+				_mm_unpackhi_epi8(bottom1, zero));
+			__m128i second = _mm_add_epi16(_mm_unpacklo_epi64(low, high),
+				_mm_unpackhi_epi64(low, high));
+
+			first = _mm_srli_epi16(_mm_add_epi16(first, rounding), 2);
+			second = _mm_srli_epi16(_mm_add_epi16(second, rounding), 2);
+			_mm_storeu_si128((__m128i*)(row + x),
+				_mm_packus_epi16(first, second));
+		}
+#endif
+		for (; x < targetWidth; x++) {
+			row[x] = AveragePixels(top[2 * x], top[2 * x + 1],
+				bottom[2 * x], bottom[2 * x + 1]);
+		}
+	}
+}
+
+
+// Scales the source down to the target size with an area filter, first
+// along the rows and then along the columns, and makes it opaque.
+void
+DesktopTexture::_Resample(const uint32_t* source, int width, int height,
+	size_t stride, uint32_t* target, int targetWidth, int targetHeight)
+{
+	if (width == targetWidth && height == targetHeight) {
+		for (int y = 0; y < height; y++) {
+			const uint32_t* in = source + (size_t)y * stride;
+			uint32_t* out = target + (size_t)y * width;
+			for (int x = 0; x < width; x++)
+				out[x] = in[x] | kAlphaMask;
+		}
+		return;
+	}
+
+	FilterTaps columns;
+	FilterTaps rows;
+	columns.Build(width, targetWidth);
+	rows.Build(height, targetHeight);
+
+	// The rows scaled horizontally, four channels with kFractionBits
+	// fractional bits, small enough for signed 16-bit lanes
+	std::vector<uint16_t> scaled((size_t)targetWidth * height * 4);
+	const int shift = kWeightBits - kFractionBits;
+	for (int y = 0; y < height; y++) {
+		const uint32_t* in = source + (size_t)y * stride;
+		uint16_t* out = &scaled[(size_t)y * targetWidth * 4];
+		for (int x = 0; x < targetWidth; x++, out += 4) {
+			const uint32_t* pixel = in + columns.first[x];
+			const uint32_t* weight = &columns.weights[columns.weightStart[x]];
+#if defined(__SSE2__)
+			// All four channels at once, as 32-bit lanes of which the
+			// upper halves are zero
+			const __m128i zero = _mm_setzero_si128();
+			__m128i sum = _mm_setzero_si128();
+			for (int i = 0; i < columns.count[x]; i++) {
+				__m128i channels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+					_mm_cvtsi32_si128((int)pixel[i]), zero), zero);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(channels,
+					_mm_set1_epi32((int)weight[i])));
+			}
+			sum = _mm_srli_epi32(sum, shift);
+			_mm_storel_epi64((__m128i*)out, _mm_packs_epi32(sum, sum));
+#else
+			uint32_t b = 0, g = 0, r = 0;
+			for (int i = 0; i < columns.count[x]; i++) {
+				b += weight[i] * (pixel[i] & 0xff);
+				g += weight[i] * (pixel[i] >> 8 & 0xff);
+				r += weight[i] * (pixel[i] >> 16 & 0xff);
+			}
+			out[0] = (uint16_t)(b >> shift);
+			out[1] = (uint16_t)(g >> shift);
+			out[2] = (uint16_t)(r >> shift);
+#endif
+		}
+	}
+
+	const int bits = kWeightBits + kFractionBits;
+	const uint32_t rounding = 1 << (bits - 1);
+	const size_t rowLength = (size_t)targetWidth * 4;
+	for (int y = 0; y < targetHeight; y++) {
+		const uint32_t* weight = &rows.weights[rows.weightStart[y]];
+		const uint16_t* first = &scaled[rows.first[y] * rowLength];
+		uint32_t* out = target + (size_t)y * targetWidth;
+		int x = 0;
+#if defined(__SSE2__)
+		// Two pixels at a time, from the 32-bit products of 16-bit lanes
+		for (; x + 2 <= targetWidth; x += 2) {
+			const uint16_t* in = first + x * 4;
+			__m128i low = _mm_set1_epi32((int)rounding);
+			__m128i high = low;
+			for (int i = 0; i < rows.count[y]; i++, in += rowLength) {
+				__m128i values = _mm_loadu_si128((const __m128i*)in);
+				__m128i factor = _mm_set1_epi16((short)weight[i]);
+				__m128i productLow = _mm_mullo_epi16(values, factor);
+				__m128i productHigh = _mm_mulhi_epu16(values, factor);
+				low = _mm_add_epi32(low,
+					_mm_unpacklo_epi16(productLow, productHigh));
+				high = _mm_add_epi32(high,
+					_mm_unpackhi_epi16(productLow, productHigh));
+			}
+			__m128i pixels = _mm_packs_epi32(_mm_srli_epi32(low, bits),
+				_mm_srli_epi32(high, bits));
+			pixels = _mm_or_si128(_mm_packus_epi16(pixels, pixels),
+				_mm_set1_epi32((int)kAlphaMask));
+			_mm_storel_epi64((__m128i*)(out + x), pixels);
+		}
+#endif
+		for (; x < targetWidth; x++) {
+			const uint16_t* in = first + x * 4;
+			uint32_t b = rounding, g = rounding, r = rounding;
+			for (int i = 0; i < rows.count[y]; i++, in += rowLength) {
+				b += weight[i] * in[0];
+				g += weight[i] * in[1];
+				r += weight[i] * in[2];
+			}
+			out[x] = kAlphaMask | (r >> bits) << 16 | (g >> bits) << 8
+				| (b >> bits);
+		}
+	}
+}
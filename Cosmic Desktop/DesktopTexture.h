@@ -0,0 +1,95 @@
+/*
+ * DesktopTexture.h
+ *
+ * Turns a screen capture into the texture of the desktop box. The capture
+ * is scaled down on the CPU to the largest size the view can show, and the
+ * mipmap levels below it are built by halving it with a box filter. All
+ * levels share one block of 32-bit pixels in B_RGB32 byte order, which GL
+ * takes as GL_BGRA with GL_UNSIGNED_INT_8_8_8_8_REV without converting it.
+ * The block can be written to a file and mapped back in by a later run, so
+ * that a texture is only built once for the same screen content.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef DESKTOP_TEXTURE_H
+#define DESKTOP_TEXTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class DesktopTexture {
+public:
+								DesktopTexture();
+								~DesktopTexture();
+
+			// Builds all levels from a capture of width x height pixels
+			// with bytesPerRow bytes per row. Level 0 keeps the aspect
+			// ratio of the capture and fits into maxWidth x maxHeight; the
+			// capture is never scaled up. The alpha channel is made opaque.
+			void				Build(const void* bits, int width,
+									int height, int bytesPerRow,
+									int maxWidth, int maxHeight);
+			void				Clear();
+
+			// Writes the texture to path, tagged with key, by way of a
+			// temporary file that then replaces it. The file can only be
+			// read by its owner.
+			bool				WriteFile(const char* path,
+									uint64_t key) const;
+			// Maps the texture written to path with the same key, which it
+			// keeps using until it is cleared. Fails and leaves the texture
+			// empty if there is no such file, it does not hold a texture
+			// of this format, or its pixels do not match their checksum.
+			bool				MapFile(const char* path, uint64_t key);
+
+			int					CountLevels() const
+									{ return (int)fLevels.size(); }
+			int					Width(int level = 0) const
+									{ return fLevels[level].width; }
+			int					Height(int level = 0) const
+									{ return fLevels[level].height; }
+			const uint32_t*		Bits(int level = 0) const
+									{ return fBits + fLevels[level].offset; }
+			// Bytes of all levels together
+			size_t				Size() const
+									{ return fPixelCount * sizeof(uint32_t); }
+			// The size passed to Build()
+			int					MaxWidth() const { return fMaxWidth; }
+			int					MaxHeight() const { return fMaxHeight; }
+
+private:
+			struct Level {
+				int				width;
+				int				height;
+				size_t			offset;
+			};
+
+								DesktopTexture(const DesktopTexture&);
+			DesktopTexture&		operator=(const DesktopTexture&);
+
+			// Lays out levels from width x height down to 1 x 1
+			void				_AddLevels(int width, int height);
+
+	static	void				_Halve(const uint32_t* source, int width,
+									int height, size_t stride,
+									uint32_t* target);
+	static	void				_Resample(const uint32_t* source, int width,
+									int height, size_t stride,
+									uint32_t* target, int targetWidth,
+									int targetHeight);
+
+			std::vector<uint32_t> fPixels;
+			std::vector<Level>	fLevels;
+			// Either fPixels or in the mapped file
+			const uint32_t*		fBits;
+			size_t				fPixelCount;
+			void*				fMapping;
+			size_t				fMappingSize;
+			int					fMaxWidth;
+			int					fMaxHeight;
+};
+
+#endif // DESKTOP_TEXTURE_H
@@ -0,0 +1,445 @@
+/*
+ * DesktopTiles.cpp
+ *
+ * Tile motion for the shattered desktop of the Cosmic Desktop screen saver.
+ */
+
+#include "DesktopTiles.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "StarField.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Time from the first tile breaking off at the center to the last one at
+// the corners
+static const float kSpreadTime = 0.5f;
+// Random delay added to the time a tile breaks off
+static const float kBreakJitter = 0.05f;
+// Speeds of the tiles away from the center and away from the viewer, and
+// their angular speeds, in units per unit of time
+static const float kMinBurstSpeed = 0.3f;
+static const float kMaxBurstSpeed = 1.0f;
+static const float kMinDepthSpeed = 0.5f;
+static const float kMaxDepthSpeed = 2.0f;
+static const float kMinSpin = 2.0f;
+static const float kMaxSpin = 8.0f;
+
+
+DesktopTiles::DesktopTiles()
+	:
+	fColumns(0),
+	fRows(0),
+	fHalfTileWidth(0.0f),
+	fHalfTileHeight(0.0f),
+	fTime(0.0f),
+	fAmbient(1.0f),
+	fDiffuse(0.0f)
+{
+	fLight[0] = fLight[1] = 0.0f;
+	fLight[2] = 1.0f;
+}
+
+
+void
+DesktopTiles::Build(int columns, int rows, float halfWidth,
+	float halfHeight, float z, uint32_t seed)
+{
+	fColumns = columns;
+	fRows = rows;
+	fHalfTileWidth = halfWidth / columns;
+	fHalfTileHeight = halfHeight / rows;
+	fTime = 0.0f;
+
+	int count = columns * rows;
+	fX.resize(count);
+	fY.resize(count);
+	fZ.resize(count);
+	fVelocityX.resize(count);
+	fVelocityY.resize(count);
+	fVelocityZ.resize(count);
+	fRotationW.resize(count);
+	fRotationX.resize(count);
+	fRotationY.resize(count);
+	fRotationZ.resize(count);
+	fSpinX.resize(count);
+	fSpinY.resize(count);
+	fSpinZ.resize(count);
+	fBreakTime.resize(count);
+
+	StarRandom random(seed);
+	float radius = sqrtf(halfWidth * halfWidth + halfHeight * halfHeight);
+	for (int row = 0, i = 0; row < rows; row++) {
+		for (int column = 0; column < columns; column++, i++) {
+			float x = (2 * column + 1) * fHalfTileWidth - halfWidth;
+			float y = halfHeight - (2 * row + 1) * fHalfTileHeight;
+			fX[i] = x;
+			fY[i] = y;
+			fZ[i] = z;
+			fRotationW[i] = 1.0f;
+			fRotationX[i] = fRotationY[i] = fRotationZ[i] = 0.0f;
+
+			// Tiles burst away from the center, the center one in any
+			// direction
+			float distance = sqrtf(x * x + y * y);
+			float directionX;
+			float directionY;
+			if (distance > fHalfTileWidth / 2) {
+				directionX = x / distance;
+				directionY = y / distance;
+			} else {
+				float angle = random.Unit() * 2 * (float)M_PI;
+				directionX = cosf(angle);
+				directionY = sinf(angle);
+			}
+			float speed = kMinBurstSpeed
+				+ (kMaxBurstSpeed - kMinBurstSpeed) * random.Unit();
+			fVelocityX[i] = directionX * speed;
+			fVelocityY[i] = directionY * speed;
+			fVelocityZ[i] = -(kMinDepthSpeed
+				+ (kMaxDepthSpeed - kMinDepthSpeed) * random.Unit());
+
+			// Any axis, from a point picked uniformly in the unit ball
+			float axisX, axisY, axisZ, length;
+			do {
+				axisX = random.Unit() * 2 - 1;
+				axisY = random.Unit() * 2 - 1;
+				axisZ = random.Unit() * 2 - 1;
+				length = sqrtf(axisX * axisX + axisY * axisY + axisZ * axisZ);
+			} while (length > 1.0f || length < 0.01f);
+			float spin = (kMinSpin + (kMaxSpin - kMinSpin) * random.Unit())
+				/ length;
+			fSpinX[i] = axisX * spin;
+			fSpinY[i] = axisY * spin;
+			fSpinZ[i] = axisZ * spin;
+
+			fBreakTime[i] = distance / radius * kSpreadTime
+				+ random.Unit() * kBreakJitter;
+		}
+	}
+}
+
+
+void
+DesktopTiles::SetLight(const float direction[3], float ambient,
+	float diffuse)
+{
+	float length = sqrtf(direction[0] * direction[0]
+		+ direction[1] * direction[1] + direction[2] * direction[2]);
+	for (int i = 0; i < 3; i++)
+		fLight[i] = direction[i] / length;
+	fAmbient = ambient;
+	fDiffuse = diffuse;
+}
+
+
+// Moves the tiles by the part of delta after they broke off, and turns
+// them by their angular velocity: the derivative of the orientation q is
+// (0, spin) * q / 2, after which q is made a unit quaternion again. That
+// step alone turns a tile by 2 atan(a / 2) rather than by a = |spin| step,
+// which falls behind on the long steps of a low frame rate, so the step is
+// stretched by tan(a / 2) / (a / 2), to its first three terms.
+void
+DesktopTiles::Advance(float delta)
+{
+	int count = CountTiles();
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+	const __m128 twoFifteenths = _mm_set1_ps(2.0f / 15.0f);
+	const __m128 deltaVector = _mm_set1_ps(delta);
+	const __m128 end = _mm_set1_ps(fTime + delta);
+	for (; i + 4 <= count; i += 4) {
+		__m128 step = _mm_min_ps(_mm_max_ps(
+			_mm_sub_ps(end, _mm_loadu_ps(&fBreakTime[i])), zero),
+			deltaVector);
+
+		_mm_storeu_ps(&fX[i], _mm_add_ps(_mm_loadu_ps(&fX[i]),
+			_mm_mul_ps(_mm_loadu_ps(&fVelocityX[i]), step)));
+		_mm_storeu_ps(&fY[i], _mm_add_ps(_mm_loadu_ps(&fY[i]),
+			_mm_mul_ps(_mm_loadu_ps(&fVelocityY[i]), step)));
+		_mm_storeu_ps(&fZ[i], _mm_add_ps(_mm_loadu_ps(&fZ[i]),
+			_mm_mul_ps(_mm_loadu_ps(&fVelocityZ[i]), step)));
+
+		__m128 w = _mm_loadu_ps(&fRotationW[i]);
+		__m128 x = _mm_loadu_ps(&fRotationX[i]);
+		__m128 y = _mm_loadu_ps(&fRotationY[i]);
+		__m128 z = _mm_loadu_ps(&fRotationZ[i]);
+		__m128 spinX = _mm_loadu_ps(&fSpinX[i]);
+		__m128 spinY = _mm_loadu_ps(&fSpinY[i]);
+		__m128 spinZ = _mm_loadu_ps(&fSpinZ[i]);
+
+		__m128 dw = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(zero,
+			_mm_mul_ps(spinX, x)), _mm_mul_ps(spinY, y)),
+			_mm_mul_ps(spinZ, z));
+		__m128 dx = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(spinX, w),
+			_mm_mul_ps(spinY, z)), _mm_mul_ps(spinZ, y));
+		__m128 dy = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(spinY, w),
+			_mm_mul_ps(spinZ, x)), _mm_mul_ps(spinX, z));
+		__m128 dz = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(spinZ, w),
+			_mm_mul_ps(spinX, y)), _mm_mul_ps(spinY, x));
+
+		__m128 halfAngle2 = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(spinX, spinX), _mm_mul_ps(spinY, spinY)),
+			_mm_mul_ps(spinZ, spinZ)), _mm_mul_ps(step, step)), quarter);
+		__m128 factor = _mm_mul_ps(_mm_mul_ps(half, step), _mm_add_ps(one,
+			_mm_mul_ps(halfAngle2, _mm_add_ps(third,
+				_mm_mul_ps(halfAngle2, twoFifteenths)))));
+		w = _mm_add_ps(w, _mm_mul_ps(factor, dw));
+		x = _mm_add_ps(x, _mm_mul_ps(factor, dx));
+		y = _mm_add_ps(y, _mm_mul_ps(factor, dy));
+		z = _mm_add_ps(z, _mm_mul_ps(factor, dz));
+
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(w, w), _mm_mul_ps(x, x)), _mm_mul_ps(y, y)),
+			_mm_mul_ps(z, z)));
+		_mm_storeu_ps(&fRotationW[i], _mm_div_ps(w, length));
+		_mm_storeu_ps(&fRotationX[i], _mm_div_ps(x, length));
+		_mm_storeu_ps(&fRotationY[i], _mm_div_ps(y, length));
+		_mm_storeu_ps(&fRotationZ[i], _mm_div_ps(z, length));
+	}
+#endif
+	for (; i < count; i++)
+		_Step(i, delta);
+
+	fTime += delta;
+}
+
+
+void
+DesktopTiles::GetTextureCoordinates(float* coordinates) const
+{
+	// Texture row 0 is the top of the desktop
+	for (int row = 0; row < fRows; row++) {
+		float top = (float)row / fRows;
+		float bottom = (float)(row + 1) / fRows;
+		for (int column = 0; column < fColumns; column++, coordinates += 8) {
+			float left = (float)column / fColumns;
+			float right = (float)(column + 1) / fColumns;
+			coordinates[0] = left;
+			coordinates[1] = bottom;
+			coordinates[2] = right;
+			coordinates[3] = bottom;
+			coordinates[4] = right;
+			coordinates[5] = top;
+			coordinates[6] = left;
+			coordinates[7] = top;
+		}
+	}
+}
+
+
+void
+DesktopTiles::GetIndices(uint32_t* indices) const
+{
+	int count = CountTiles();
+	for (int i = 0; i < count; i++, indices += 6) {
+		uint32_t first = (uint32_t)i * 4;
+		indices[0] = first;
+		indices[1] = first + 1;
+		indices[2] = first + 2;
+		indices[3] = first;
+		indices[4] = first + 2;
+		indices[5] = first + 3;
+	}
+}
+
+
+// The corners of a tile are its center -u - v, +u - v, +u + v and -u + v,
+// where u and v are the first two columns of its rotation matrix scaled to
+// half the size of the tile. The third column is its normal.
+void
+DesktopTiles::GetVertices(Vertex* vertices, float opacity) const
+{
+	int count = CountTiles();
+	uint8_t alpha = (uint8_t)(std::max(0.0f, std::min(1.0f, opacity))
+		* 255.0f + 0.5f);
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 halfWidth = _mm_set1_ps(fHalfTileWidth);
+	const __m128 halfHeight = _mm_set1_ps(fHalfTileHeight);
+	const __m128 lightX = _mm_set1_ps(fLight[0]);
+	const __m128 lightY = _mm_set1_ps(fLight[1]);
+	const __m128 lightZ = _mm_set1_ps(fLight[2]);
+	const __m128 ambient = _mm_set1_ps(fAmbient);
+	const __m128 diffuse = _mm_set1_ps(fDiffuse);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	const __m128 rounding = _mm_set1_ps(0.5f);
+	const __m128 absoluteMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128i alphaBits = _mm_set1_epi32((int)((uint32_t)alpha << 24));
+	for (; i + 4 <= count; i += 4) {
+		__m128 w = _mm_loadu_ps(&fRotationW[i]);
+		__m128 x = _mm_loadu_ps(&fRotationX[i]);
+		__m128 y = _mm_loadu_ps(&fRotationY[i]);
+		__m128 z = _mm_loadu_ps(&fRotationZ[i]);
+		__m128 xx = _mm_mul_ps(x, x);
+		__m128 yy = _mm_mul_ps(y, y);
+		__m128 zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y);
+		__m128 xz = _mm_mul_ps(x, z);
+		__m128 yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x);
+		__m128 wy = _mm_mul_ps(w, y);
+		__m128 wz = _mm_mul_ps(w, z);
+
+		__m128 uX = _mm_mul_ps(_mm_sub_ps(one,
+			_mm_mul_ps(two, _mm_add_ps(yy, zz))), halfWidth);
+		__m128 uY = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)),
+			halfWidth);
+		__m128 uZ = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)),
+			halfWidth);
+		__m128 vX = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)),
+			halfHeight);
+		__m128 vY = _mm_mul_ps(_mm_sub_ps(one,
+			_mm_mul_ps(two, _mm_add_ps(xx, zz))), halfHeight);
+		__m128 vZ = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)),
+			halfHeight);
+		__m128 normalX = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+		__m128 normalY = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+		__m128 normalZ = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+		// Both sides are lit, so the sign of the angle does not matter
+		__m128 lambert = _mm_and_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(normalX, lightX), _mm_mul_ps(normalY, lightY)),
+			_mm_mul_ps(normalZ, lightZ)), absoluteMask);
+		__m128 brightness = _mm_min_ps(_mm_add_ps(ambient,
+			_mm_mul_ps(diffuse, lambert)), one);
+		__m128i gray = _mm_cvttps_epi32(_mm_add_ps(
+			_mm_mul_ps(brightness, scale), rounding));
+		__m128i color = _mm_or_si128(_mm_or_si128(gray,
+			_mm_slli_epi32(gray, 8)), _mm_or_si128(_mm_slli_epi32(gray, 16),
+			alphaBits));
+
+		__m128 centerX = _mm_loadu_ps(&fX[i]);
+		__m128 centerY = _mm_loadu_ps(&fY[i]);
+		__m128 centerZ = _mm_loadu_ps(&fZ[i]);
+		__m128 leftX = _mm_sub_ps(centerX, uX);
+		__m128 leftY = _mm_sub_ps(centerY, uY);
+		__m128 leftZ = _mm_sub_ps(centerZ, uZ);
+		__m128 rightX = _mm_add_ps(centerX, uX);
+		__m128 rightY = _mm_add_ps(centerY, uY);
+		__m128 rightZ = _mm_add_ps(centerZ, uZ);
+
+		// Each corner of four tiles makes four vertices of x, y, z and
+		// color once transposed, one for each tile
+		__m128 corners[4][4] = {
+			{ _mm_sub_ps(leftX, vX), _mm_sub_ps(leftY, vY),
+				_mm_sub_ps(leftZ, vZ), _mm_castsi128_ps(color) },
+			{ _mm_sub_ps(rightX, vX), _mm_sub_ps(rightY, vY),
+				_mm_sub_ps(rightZ, vZ), _mm_castsi128_ps(color) },
+			{ _mm_add_ps(rightX, vX), _mm_add_ps(rightY, vY),
+				_mm_add_ps(rightZ, vZ), _mm_castsi128_ps(color) },
+			{ _mm_add_ps(leftX, vX), _mm_add_ps(leftY, vY),
+				_mm_add_ps(leftZ, vZ), _mm_castsi128_ps(color) }
+		};
+		Vertex* quads = vertices + i * 4;
+		for (int corner = 0; corner < 4; corner++) {
+			__m128* vertex = corners[corner];
+			_MM_TRANSPOSE4_PS(vertex[0], vertex[1], vertex[2], vertex[3]);
+			for (int lane = 0; lane < 4; lane++)
+				_mm_storeu_ps((float*)&quads[lane * 4 + corner], vertex[lane]);
+		}
+	}
+#endif
+	for (; i < count; i++)
+		_GetVertices(i, vertices + i * 4, alpha);
+}
+
+
+// One tile of Advance(), with the operations in the same order
+void
+DesktopTiles::_Step(int index, float delta)
+{
+	int i = index;
+	float step = std::min(std::max(fTime + delta - fBreakTime[i], 0.0f),
+		delta);
+
+	fX[i] = fX[i] + fVelocityX[i] * step;
+	fY[i] = fY[i] + fVelocityY[i] * step;
+	fZ[i] = fZ[i] + fVelocityZ[i] * step;
+
+	float w = fRotationW[i];
+	float x = fRotationX[i];
+	float y = fRotationY[i];
+	float z = fRotationZ[i];
+	float dw = 0.0f - fSpinX[i] * x - fSpinY[i] * y - fSpinZ[i] * z;
+	float dx = fSpinX[i] * w + fSpinY[i] * z - fSpinZ[i] * y;
+	float dy = fSpinY[i] * w + fSpinZ[i] * x - fSpinX[i] * z;
+	float dz = fSpinZ[i] * w + fSpinX[i] * y - fSpinY[i] * x;
+
+	float halfAngle2 = (fSpinX[i] * fSpinX[i] + fSpinY[i] * fSpinY[i]
+		+ fSpinZ[i] * fSpinZ[i]) * (step * step) * 0.25f;
+	float factor = (0.5f * step)
+		* (1.0f + halfAngle2 * (1.0f / 3.0f + halfAngle2 * (2.0f / 15.0f)));
+	w = w + factor * dw;
+	x = x + factor * dx;
+	y = y + factor * dy;
+	z = z + factor * dz;
+
+	float length = sqrtf(w * w + x * x + y * y + z * z);
+	fRotationW[i] = w / length;
+	fRotationX[i] = x / length;
+	fRotationY[i] = y / length;
+	fRotationZ[i] = z / length;
+}
+
+
+// One tile of GetVertices(), with the operations in the same order
+void
+DesktopTiles::_GetVertices(int index, Vertex* vertices, uint8_t alpha) const
+{
+	int i = index;
+	float w = fRotationW[i];
+	float x = fRotationX[i];
+	float y = fRotationY[i];
+	float z = fRotationZ[i];
+	float xx = x * x, yy = y * y, zz = z * z;
+	float xy = x * y, xz = x * z, yz = y * z;
+	float wx = w * x, wy = w * y, wz = w * z;
+
+	float uX = (1.0f - 2.0f * (yy + zz)) * fHalfTileWidth;
+	float uY = 2.0f * (xy + wz) * fHalfTileWidth;
+	float uZ = 2.0f * (xz - wy) * fHalfTileWidth;
+	float vX = 2.0f * (xy - wz) * fHalfTileHeight;
+	float vY = (1.0f - 2.0f * (xx + zz)) * fHalfTileHeight;
+	float vZ = 2.0f * (yz + wx) * fHalfTileHeight;
+	float normalX = 2.0f * (xz + wy);
+	float normalY = 2.0f * (yz - wx);
+	float normalZ = 1.0f - 2.0f * (xx + yy);
+
+	float lambert = fabsf(normalX * fLight[0] + normalY * fLight[1]
+		+ normalZ * fLight[2]);
+	float brightness = std::min(fAmbient + fDiffuse * lambert, 1.0f);
+	uint8_t gray = (uint8_t)(int)(brightness * 255.0f + 0.5f);
+
+	float leftX = fX[i] - uX, leftY = fY[i] - uY, leftZ = fZ[i] - uZ;
+	float rightX = fX[i] + uX, rightY = fY[i] + uY, rightZ = fZ[i] + uZ;
+	const float corners[4][3] = {
+		{ leftX - vX, leftY - vY, leftZ - vZ },
+		{ rightX - vX, rightY - vY, rightZ - vZ },
+		{ rightX + vX, rightY + vY, rightZ + vZ },
+		{ leftX + vX, leftY + vY, leftZ + vZ }
+	};
+	for (int corner = 0; corner < 4; corner++) {
+		Vertex& vertex = vertices[corner];
+		vertex.x = corners[corner][0];
+		vertex.y = corners[corner][1];
+		vertex.z = corners[corner][2];
+		vertex.color[0] = vertex.color[1] = vertex.color[2] = gray;
+		vertex.color[3] = alpha;
+	}
+}
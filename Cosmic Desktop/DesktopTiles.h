@@ -0,0 +1,106 @@
+/*
+ * DesktopTiles.h
+ *
+ * The desktop shattered into a grid of tiles that break off one after
+ * another, starting at the center, and fly away spinning. Every tile is a
+ * rigid body with its own velocity and angular velocity; positions and
+ * orientations are kept in one array per coordinate and integrated four
+ * tiles at a time with SSE2 where it is available. The tiles are lit on
+ * the CPU, so that they can be drawn as one list of triangles from one
+ * vertex array of positions and colors without GL lighting.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef DESKTOP_TILES_H
+#define DESKTOP_TILES_H
+
+#include <stdint.h>
+
+#include <vector>
+
+class DesktopTiles {
+public:
+			// Layout of the vertex array: the color is 4 bytes in R, G,
+			// B, A order, 16 bytes per vertex in all
+			struct Vertex {
+				float			x;
+				float			y;
+				float			z;
+				uint8_t			color[4];
+			};
+
+								DesktopTiles();
+
+			// Splits a rectangle of 2 * halfWidth x 2 * halfHeight that
+			// faces the positive z axis at depth z into columns x rows
+			// tiles. The first row is at the top.
+			void				Build(int columns, int rows,
+									float halfWidth, float halfHeight,
+									float z, uint32_t seed);
+
+			// Lights the tiles from the given direction like a diffuse
+			// material under a directional light, on both sides.
+			void				SetLight(const float direction[3],
+									float ambient, float diffuse);
+
+			// Lets delta units of animation time pass.
+			void				Advance(float delta);
+
+			int					CountTiles() const
+									{ return (int)fX.size(); }
+			// Four corners per tile, counterclockwise from the bottom
+			// left one as seen from the front
+			int					CountVertices() const
+									{ return CountTiles() * 4; }
+			// Two triangles per tile
+			int					CountIndices() const
+									{ return CountTiles() * 6; }
+
+			// Texture coordinates of all vertices, two floats each, and
+			// the vertices of all triangles. They do not change while the
+			// tiles move.
+			void				GetTextureCoordinates(float* coordinates)
+									const;
+			void				GetIndices(uint32_t* indices) const;
+			// Positions and colors of all vertices, with the given
+			// opacity as alpha.
+			void				GetVertices(Vertex* vertices,
+									float opacity) const;
+
+private:
+			void				_Step(int index, float delta);
+			void				_GetVertices(int index, Vertex* vertices,
+									uint8_t alpha) const;
+
+			int					fColumns;
+			int					fRows;
+			float				fHalfTileWidth;
+			float				fHalfTileHeight;
+			float				fTime;
+
+			// Centers and their velocities
+			std::vector<float>	fX;
+			std::vector<float>	fY;
+			std::vector<float>	fZ;
+			std::vector<float>	fVelocityX;
+			std::vector<float>	fVelocityY;
+			std::vector<float>	fVelocityZ;
+			// Orientations as unit quaternions, and the angular velocities
+			// in radians per unit of time
+			std::vector<float>	fRotationW;
+			std::vector<float>	fRotationX;
+			std::vector<float>	fRotationY;
+			std::vector<float>	fRotationZ;
+			std::vector<float>	fSpinX;
+			std::vector<float>	fSpinY;
+			std::vector<float>	fSpinZ;
+			// Time at which a tile breaks off
+			std::vector<float>	fBreakTime;
+
+			float				fLight[3];
+			float				fAmbient;
+			float				fDiffuse;
+};
+
+#endif // DESKTOP_TILES_H
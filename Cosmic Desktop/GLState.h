@@ -0,0 +1,182 @@
+/*
+ * GLState.h
+ *
+ * Keeps track of the GL state the view switches between its draws, so
+ * that every draw can ask for all the state it needs while GL only hears
+ * about what actually changes. It counts the changes it passes on, which
+ * include every matrix and material it is given.
+ *
+ * All GL calls that change the tracked state have to go through it.
+ */
+
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES 1
+#endif
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <stdint.h>
+
+#include <vector>
+
+class GLState {
+public:
+								GLState();
+
+			void				SetEnabled(GLenum capability, bool enabled);
+			void				SetClientState(GLenum array, bool enabled);
+			void				SetAttributeArray(GLuint index, bool enabled);
+			// GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+			void				BindBuffer(GLenum target, GLuint buffer);
+			void				UseProgram(GLuint program);
+
+			// Replaces the current matrix.
+			void				LoadMatrix(const GLfloat* matrix);
+			void				SetMaterial(GLenum face, GLenum name,
+									const GLfloat* values);
+
+			// Returns the number of changes since the last call.
+			int32_t				TakeChanges();
+
+private:
+			struct Switch {
+				GLenum			name;
+				bool			enabled;
+			};
+
+			bool				_Switch(std::vector<Switch>& switches,
+									GLenum name, bool enabled);
+
+			std::vector<Switch>	fCapabilities;
+			std::vector<Switch>	fClientStates;
+			std::vector<Switch>	fAttributeArrays;
+			// Bindings start out as in a new context
+			GLuint				fArrayBuffer;
+			GLuint				fElementBuffer;
+			GLuint				fProgram;
+			int32_t				fChanges;
+};
+
+
+inline
+GLState::GLState()
+	:
+	fArrayBuffer(0),
+	fElementBuffer(0),
+	fProgram(0),
+	fChanges(0)
+{
+}
+
+
+inline void
+GLState::SetEnabled(GLenum capability, bool enabled)
+{
+	if (!_Switch(fCapabilities, capability, enabled))
+		return;
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+}
+
+
+inline void
+GLState::SetClientState(GLenum array, bool enabled)
+{
+	if (!_Switch(fClientStates, array, enabled))
+		return;
+	if (enabled)
+		glEnableClientState(array);
+	else
+		glDisableClientState(array);
+}
+
+
+inline void
+GLState::SetAttributeArray(GLuint index, bool enabled)
+{
+	if (!_Switch(fAttributeArrays, index, enabled))
+		return;
+	if (enabled)
+		glEnableVertexAttribArray(index);
+	else
+		glDisableVertexAttribArray(index);
+}
+
+
+inline void
+GLState::BindBuffer(GLenum target, GLuint buffer)
+{
+	GLuint& bound = target == GL_ELEMENT_ARRAY_BUFFER
+		? fElementBuffer : fArrayBuffer;
+	if (bound == buffer)
+		return;
+	glBindBuffer(target, buffer);
+	bound = buffer;
+	fChanges++;
+}
+
+
+inline void
+GLState::UseProgram(GLuint program)
+{
+	if (program == fProgram)
+		return;
+	glUseProgram(program);
+	fProgram = program;
+	fChanges++;
+}
+
+
+inline void
+GLState::LoadMatrix(const GLfloat* matrix)
+{
+	glLoadMatrixf(matrix);
+	fChanges++;
+}
+
+
+inline void
+GLState::SetMaterial(GLenum face, GLenum name, const GLfloat* values)
+{
+	glMaterialfv(face, name, values);
+	fChanges++;
+}
+
+
+inline int32_t
+GLState::TakeChanges()
+{
+	int32_t changes = fChanges;
+	fChanges = 0;
+	return changes;
+}
+
+
+// Returns whether the switch has to be set; one that was not set before
+// always has to be, since its state is not known
+inline bool
+GLState::_Switch(std::vector<Switch>& switches, GLenum name, bool enabled)
+{
+	for (size_t i = 0; i < switches.size(); i++) {
+		if (switches[i].name != name)
+			continue;
+		if (switches[i].enabled == enabled)
+			return false;
+		switches[i].enabled = enabled;
+		fChanges++;
+		return true;
+	}
+
+	Switch added = { name, enabled };
+	switches.push_back(added);
+	fChanges++;
+	return true;
+}
+
+#endif // GL_STATE_H
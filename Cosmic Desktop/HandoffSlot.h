@@ -0,0 +1,42 @@
+/*
+ * HandoffSlot.h
+ *
+ * Hands results from a worker thread to the drawing thread without locks.
+ * The slot holds at most one result: publishing replaces whatever the
+ * drawing thread has not taken yet, and the drawing thread takes the
+ * latest one whenever it is ready for it, typically between two frames.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef HANDOFF_SLOT_H
+#define HANDOFF_SLOT_H
+
+#include <stddef.h>
+
+#include <atomic>
+
+template<typename Type>
+class HandoffSlot {
+public:
+								HandoffSlot() : fItem(NULL) {}
+								~HandoffSlot() { delete fItem.exchange(NULL); }
+
+			// Takes ownership of the item.
+			void				Publish(Type* item)
+									{ delete fItem.exchange(item,
+										std::memory_order_acq_rel); }
+			// Returns NULL if nothing was published since the last call;
+			// the caller owns the result.
+			Type*				Take()
+									{ return fItem.exchange(NULL,
+										std::memory_order_acq_rel); }
+
+private:
+								HandoffSlot(const HandoffSlot&);
+			HandoffSlot&		operator=(const HandoffSlot&);
+
+			std::atomic<Type*>	fItem;
+};
+
+#endif // HANDOFF_SLOT_H
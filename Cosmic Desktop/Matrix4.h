@@ -0,0 +1,112 @@
+/*
+ * Matrix4.h
+ *
+ * The few 4 x 4 matrices the view needs, computed on the CPU the way the
+ * GL and GLU functions of the same names would, so that a whole transform
+ * can be handed to GL with one glLoadMatrixf() call. Values are in column
+ * major order, as GL takes them.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef MATRIX4_H
+#define MATRIX4_H
+
+#include <math.h>
+
+class Matrix4 {
+public:
+								Matrix4()
+									{
+										for (int i = 0; i < 16; i++)
+											fValues[i] = i % 5 == 0 ? 1 : 0;
+									}
+
+			// As glTranslatef()
+	static	Matrix4				Translation(float x, float y, float z)
+									{
+										Matrix4 matrix;
+										matrix.fValues[12] = x;
+										matrix.fValues[13] = y;
+										matrix.fValues[14] = z;
+										return matrix;
+									}
+
+			// As glRotatef(), by degrees around the axis x, y, z
+	static	Matrix4				Rotation(float degrees, float x, float y,
+									float z);
+
+			// As gluPerspective()
+	static	Matrix4				Perspective(float fovY, float aspectRatio,
+									float nearZ, float farZ);
+
+			Matrix4				operator*(const Matrix4& other) const;
+
+			const float*		Values() const { return fValues; }
+
+private:
+			float				fValues[16];
+};
+
+
+inline Matrix4
+Matrix4::Rotation(float degrees, float x, float y, float z)
+{
+	Matrix4 matrix;
+	float length = sqrtf(x * x + y * y + z * z);
+	if (length == 0)
+		return matrix;
+	x /= length;
+	y /= length;
+	z /= length;
+
+	float radians = degrees * (float)M_PI / 180;
+	float c = cosf(radians);
+	float s = sinf(radians);
+	float t = 1 - c;
+	float* m = matrix.fValues;
+	m[0] = x * x * t + c;
+	m[1] = y * x * t + z * s;
+	m[2] = x * z * t - y * s;
+	m[4] = x * y * t - z * s;
+	m[5] = y * y * t + c;
+	m[6] = y * z * t + x * s;
+	m[8] = x * z * t + y * s;
+	m[9] = y * z * t - x * s;
+	m[10] = z * z * t + c;
+	return matrix;
+}
+
+
+inline Matrix4
+Matrix4::Perspective(float fovY, float aspectRatio, float nearZ, float farZ)
+{
+	Matrix4 matrix;
+	float f = 1 / tanf(fovY * (float)M_PI / 360);
+	float* m = matrix.fValues;
+	m[0] = f / aspectRatio;
+	m[5] = f;
+	m[10] = (farZ + nearZ) / (nearZ - farZ);
+	m[11] = -1;
+	m[14] = 2 * farZ * nearZ / (nearZ - farZ);
+	m[15] = 0;
+	return matrix;
+}
+
+
+inline Matrix4
+Matrix4::operator*(const Matrix4& other) const
+{
+	Matrix4 result;
+	for (int column = 0; column < 4; column++) {
+		for (int row = 0; row < 4; row++) {
+			float sum = 0;
+			for (int i = 0; i < 4; i++)
+				sum += fValues[i * 4 + row] * other.fValues[column * 4 + i];
+			result.fValues[column * 4 + row] = sum;
+		}
+	}
+	return result;
+}
+
+#endif // MATRIX4_H
@@ -0,0 +1,168 @@
+/*
+ * StarField.cpp
+ *
+ * Star placement and motion for the Cosmic Desktop screen saver.
+ */
+
+#include "StarField.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+static inline uint8_t
+ColorByte(float value)
+{
+	return (uint8_t)(std::max(0.0f, std::min(1.0f, value)) * 255.0f + 0.5f);
+}
+
+
+StarField::StarField()
+	:
+	fSlopeX(1.0f),
+	fSlopeY(1.0f),
+	fNearZ(0.1f),
+	fFarZ(1000.0f)
+{
+}
+
+
+void
+StarField::Build(int count, uint32_t seed, float fovY, float aspectRatio,
+	float nearZ, float farZ, float minSize, float maxSize)
+{
+	fX.resize(count);
+	fY.resize(count);
+	fZ.resize(count);
+	fSizes.resize(count);
+	fColors.resize(count);
+
+	fSlopeY = tanf(fovY * (float)M_PI / 180.0f / 2.0f);
+	fSlopeX = fSlopeY * aspectRatio;
+	fNearZ = nearZ;
+	fFarZ = farZ;
+	// Maximum color deviation from white
+	const float colorVariation = 0.1f;
+
+	fRandom = StarRandom(seed);
+	for (int i = 0; i < count; i++) {
+		float z = -(fRandom.Unit() * (farZ - nearZ) + nearZ);
+		fX[i] = (fRandom.Unit() * 2 - 1) * -z * fSlopeX;
+		fY[i] = (fRandom.Unit() * 2 - 1) * -z * fSlopeY;
+		fZ[i] = z;
+		fSizes[i] = minSize + (maxSize - minSize) * fRandom.Unit();
+
+		float brightness = fRandom.Unit();
+		float r = brightness + (fRandom.Unit() - 0.5f) * 0.2f * colorVariation;
+		float g = brightness + (fRandom.Unit() - 0.5f) * 0.2f * colorVariation;
+		float b = brightness + (fRandom.Unit() - 0.5f) * 0.2f * colorVariation;
+
+		// R, G, B, A in memory on little and big endian alike
+		uint8_t* color = (uint8_t*)&fColors[i];
+		color[0] = ColorByte(r);
+		color[1] = ColorByte(g);
+		color[2] = ColorByte(b);
+		color[3] = ColorByte(brightness);
+	}
+}
+
+
+int
+StarField::Advance(float distance)
+{
+	int count = CountStars();
+	int restarted = 0;
+	int i = 0;
+
+#if defined(__SSE2__)
+	// Moves four stars at a time and checks that they are still in view;
+	// the few that are not are restarted one by one
+	const __m128 step = _mm_set1_ps(distance);
+	const __m128 nearLimit = _mm_set1_ps(-fNearZ);
+	const __m128 slopeX = _mm_set1_ps(fSlopeX);
+	const __m128 slopeY = _mm_set1_ps(fSlopeY);
+	const __m128 absoluteMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for (; i + 4 <= count; i += 4) {
+		__m128 z = _mm_add_ps(_mm_loadu_ps(&fZ[i]), step);
+		_mm_storeu_ps(&fZ[i], z);
+
+		__m128 depth = _mm_sub_ps(_mm_setzero_ps(), z);
+		__m128 x = _mm_and_ps(_mm_loadu_ps(&fX[i]), absoluteMask);
+		__m128 y = _mm_and_ps(_mm_loadu_ps(&fY[i]), absoluteMask);
+		__m128 gone = _mm_or_ps(_mm_cmpgt_ps(z, nearLimit),
+			_mm_or_ps(_mm_cmpgt_ps(x, _mm_mul_ps(depth, slopeX)),
+				_mm_cmpgt_ps(y, _mm_mul_ps(depth, slopeY))));
+
+		int mask = _mm_movemask_ps(gone);
+		if (mask == 0)
+			continue;
+		for (int lane = 0; lane < 4; lane++) {
+			if ((mask & (1 << lane)) != 0) {
+				_Restart(i + lane);
+				restarted++;
+			}
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		float z = fZ[i] + distance;
+		fZ[i] = z;
+		if (z > -fNearZ || fabsf(fX[i]) > -z * fSlopeX
+			|| fabsf(fY[i]) > -z * fSlopeY) {
+			_Restart(i);
+			restarted++;
+		}
+	}
+	return restarted;
+}
+
+
+void
+StarField::GetPositions(float* positions) const
+{
+	int count = CountStars();
+	int i = 0;
+
+#if defined(__SSE2__)
+	// Four stars make three vectors of x, y, z, x | y, z, x, y | z, x, y, z
+	for (; i + 4 <= count; i += 4, positions += 12) {
+		__m128 x = _mm_loadu_ps(&fX[i]);
+		__m128 y = _mm_loadu_ps(&fY[i]);
+		__m128 z = _mm_loadu_ps(&fZ[i]);
+		__m128 xyLow = _mm_unpacklo_ps(x, y);
+		__m128 xyHigh = _mm_unpackhi_ps(x, y);
+
+		__m128 zx = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+		_mm_storeu_ps(positions, _mm_shuffle_ps(xyLow, zx,
+			_MM_SHUFFLE(2, 0, 1, 0)));
+		__m128 yz = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+		_mm_storeu_ps(positions + 4, _mm_shuffle_ps(yz, xyHigh,
+			_MM_SHUFFLE(1, 0, 2, 0)));
+		zx = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+		yz = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+		_mm_storeu_ps(positions + 8, _mm_shuffle_ps(zx, yz,
+			_MM_SHUFFLE(2, 0, 2, 0)));
+	}
+#endif
+	for (; i < count; i++, positions += 3) {
+		positions[0] = fX[i];
+		positions[1] = fY[i];
+		positions[2] = fZ[i];
+	}
+}
+
+
+// Puts the star at the far plane, somewhere within the view
+void
+StarField::_Restart(int index)
+{
+	float depth = fFarZ;
+	fX[index] = (fRandom.Unit() * 2 - 1) * depth * fSlopeX;
+	fY[index] = (fRandom.Unit() * 2 - 1) * depth * fSlopeY;
+	fZ[index] = -depth;
+}
@@ -0,0 +1,85 @@
+/*
+ * StarField.h
+ *
+ * The stars behind the desktop box, kept per view in one array for each of
+ * their coordinates, sizes and colors. The stars fill the view volume of a
+ * camera at the origin looking down the negative z axis, and stream
+ * towards it: a star that passes the near plane or leaves the view volume
+ * starts over at the far plane, so every star stays visible. The arrays
+ * are updated four stars at a time with SSE2 where it is available.
+ *
+ * This file has no Haiku dependencies.
+ */
+
+#ifndef STAR_FIELD_H
+#define STAR_FIELD_H
+
+#include <stdint.h>
+
+#include <vector>
+
+// Small generator for the placement, so that every view has its own
+// sequence and does not touch the state of rand()
+class StarRandom {
+public:
+								StarRandom(uint32_t seed = 0)
+									: fState(seed * 2654435761u + 1) {}
+
+			// Uniform in [0, 1]
+			float				Unit()
+								{
+									fState ^= fState << 13;
+									fState ^= fState >> 17;
+									fState ^= fState << 5;
+									return (fState >> 8) / 16777215.0f;
+								}
+
+private:
+			uint32_t			fState;
+};
+
+class StarField {
+public:
+								StarField();
+
+			// Scatters count stars between nearZ and farZ in front of the
+			// camera, within its vertical field of view of fovY degrees at
+			// the given aspect ratio. Point sizes are in pixels.
+			void				Build(int count, uint32_t seed, float fovY,
+									float aspectRatio, float nearZ,
+									float farZ, float minSize,
+									float maxSize);
+
+			// Moves all stars distance units towards the camera, and
+			// returns how many of them started over.
+			int					Advance(float distance);
+
+			int					CountStars() const
+									{ return (int)fZ.size(); }
+
+			// Interleaves the coordinates as x, y, z for vertex arrays.
+			void				GetPositions(float* positions) const;
+			// Colors are 4 bytes each in R, G, B, A order, with the
+			// brightness of the star as alpha.
+			const uint32_t*		Colors() const { return &fColors[0]; }
+			const float*		Sizes() const { return &fSizes[0]; }
+
+private:
+			void				_Restart(int index);
+
+			std::vector<float>	fX;
+			std::vector<float>	fY;
+			std::vector<float>	fZ;
+			std::vector<float>	fSizes;
+			std::vector<uint32_t> fColors;
+
+			// The view volume: a star at depth -z is visible up to
+			// z * fSlopeX to the sides and z * fSlopeY up and down
+			float				fSlopeX;
+			float				fSlopeY;
+			float				fNearZ;
+			float				fFarZ;
+			StarRandom			fRandom;
+};
+
+#endif // STAR_FIELD_H
@@ -0,0 +1,114 @@
+/*
+ * starfield_benchmark.cpp
+ *
+ * Starfield benchmark for Cosmic Desktop on Linux. Streams the stars of the
+ * screen saver towards the camera for a number of frames, interleaving
+ * their positions for upload after every step as the view does, and
+ * reports the CPU time per frame, the number of stars that started over
+ * and a checksum of the final positions. The stars are the same for the
+ * same count and seed, so changes to the update can be measured and
+ * checked without a display.
+ *
+ * Usage: starfield_benchmark [-n stars] [-f frames] [-d distance]
+ *            [-S seed]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "StarField.h"
+
+
+static double
+elapsed_ms(clockid_t clock, const timespec& start)
+{
+	timespec now;
+	clock_gettime(clock, &now);
+	return (now.tv_sec - start.tv_sec) * 1000.0
+		+ (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+
+static uint64_t
+fnv1a_checksum(const std::vector<float>& data)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const uint8_t* bytes = (const uint8_t*)&data[0];
+	for (size_t i = 0; i < data.size() * sizeof(float); i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-n stars] [-f frames] [-d distance] "
+		"[-S seed]\n", name);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	int starCount = 200000;
+	int frames = 1000;
+	float distance = 2.0f;
+	unsigned seed = 1;
+
+	int option;
+	while ((option = getopt(argc, argv, "n:f:d:S:h")) != -1) {
+		switch (option) {
+			case 'n':
+				starCount = atoi(optarg);
+				break;
+			case 'f':
+				frames = atoi(optarg);
+				break;
+			case 'd':
+				distance = atof(optarg);
+				break;
+			case 'S':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (starCount < 1 || frames < 1 || distance < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// The view volume of the screen saver at 16:9
+	StarField stars;
+	stars.Build(starCount, seed, 45.0f, 16.0f / 9.0f, 0.1f, 1000.0f, 2.0f,
+		3.0f);
+	std::vector<float> positions(starCount * 3);
+
+	timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long restarted = 0;
+	for (int frame = 0; frame < frames; frame++) {
+		restarted += stars.Advance(distance);
+		stars.GetPositions(&positions[0]);
+	}
+	double wallTime = elapsed_ms(CLOCK_MONOTONIC, start);
+
+	printf("stars: %d, %d frames, %.2f units/frame\n", starCount, frames,
+		distance);
+	printf("time/frame: %.3f ms\n", wallTime / frames);
+	printf("restarts/frame: %.1f\n", (double)restarted / frames);
+	printf("checksum: %016llx\n",
+		(unsigned long long)fnv1a_checksum(positions));
+	return 0;
+}
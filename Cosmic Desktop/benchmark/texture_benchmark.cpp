@@ -0,0 +1,214 @@
+/*
+ * texture_benchmark.cpp
+ *
+ * Desktop texture benchmark for Cosmic Desktop on Linux. Builds the texture
+ * of the desktop box from a synthetic screen capture a number of times and
+ * reports the time per build, the size of the texture against that of the
+ * capture, and a checksum of all levels. The capture is the same for the
+ * same size and seed, so filter changes can be measured and checked without
+ * a display. With -c, the texture is also written to a texture file and
+ * mapped back from it, as a later run of the screen saver would, and the
+ * time to map it is reported along with the checksum of the mapped levels.
+ *
+ * Usage: texture_benchmark [-s WIDTHxHEIGHT] [-t WIDTHxHEIGHT] [-n builds]
+ *            [-S seed] [-o level0.ppm] [-c texture-file]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "DesktopTexture.h"
+
+
+// Rows of a B_RGB32 bitmap are padded like this on Haiku
+static const int kRowAlignment = 64;
+
+
+static double
+elapsed_ms(clockid_t clock, const timespec& start)
+{
+	timespec now;
+	clock_gettime(clock, &now);
+	return (now.tv_sec - start.tv_sec) * 1000.0
+		+ (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+
+// A desktop-like capture: a gradient with windows on it, and lines of
+// one pixel wide glyphs that alias badly when they are not filtered
+static void
+make_capture(std::vector<uint32_t>& pixels, int width, int height,
+	int stride, unsigned seed)
+{
+	pixels.assign((size_t)stride * height, 0);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			pixels[(size_t)y * stride + x] = 0xff000000
+				| (uint32_t)(x * 255 / width) << 16
+				| (uint32_t)(y * 255 / height) << 8 | 0x80;
+		}
+	}
+
+	srand(seed);
+	for (int window = 0; window < 24; window++) {
+		int left = rand() % width;
+		int top = rand() % height;
+		int right = std::min(width, left + width / 8 + rand() % (width / 3));
+		int bottom = std::min(height, top + height / 8
+			+ rand() % (height / 3));
+		// The top byte is left undefined, as in a real capture
+		uint32_t color = (uint32_t)rand() << 8 ^ (uint32_t)rand();
+		for (int y = top; y < bottom; y++) {
+			for (int x = left; x < right; x++) {
+				bool glyph = (y - top) % 14 < 10 && (x * 7 + y * 3) % 5 < 2;
+				pixels[(size_t)y * stride + x] = glyph ? 0x10101010 : color;
+			}
+		}
+	}
+}
+
+
+static uint64_t
+fnv1a_checksum(const DesktopTexture& texture)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const uint8_t* bytes = (const uint8_t*)texture.Bits(0);
+	for (size_t i = 0; i < texture.Size(); i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+static bool
+write_ppm(const char* path, const DesktopTexture& texture)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", texture.Width(), texture.Height());
+	const uint32_t* pixels = texture.Bits(0);
+	for (int i = 0; i < texture.Width() * texture.Height(); i++) {
+		uint8_t rgb[3] = { (uint8_t)(pixels[i] >> 16),
+			(uint8_t)(pixels[i] >> 8), (uint8_t)pixels[i] };
+		fwrite(rgb, 1, 3, file);
+	}
+	return fclose(file) == 0;
+}
+
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-s WIDTHxHEIGHT] [-t WIDTHxHEIGHT] "
+		"[-n builds] [-S seed] [-o level0.ppm] [-c texture-file]\n", name);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	int width = 3840;
+	int height = 2160;
+	int maxWidth = 1920;
+	int maxHeight = 1080;
+	int builds = 20;
+	unsigned seed = 1;
+	const char* imagePath = NULL;
+	const char* filePath = NULL;
+
+	int option;
+	while ((option = getopt(argc, argv, "s:t:n:S:o:c:h")) != -1) {
+		switch (option) {
+			case 's':
+				if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 't':
+				if (sscanf(optarg, "%dx%d", &maxWidth, &maxHeight) != 2) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'n':
+				builds = atoi(optarg);
+				break;
+			case 'S':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'o':
+				imagePath = optarg;
+				break;
+			case 'c':
+				filePath = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (width < 8 || height < 8 || maxWidth < 1 || maxHeight < 1
+		|| builds < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	int bytesPerRow = (width * 4 + kRowAlignment - 1) / kRowAlignment
+		* kRowAlignment;
+	std::vector<uint32_t> capture;
+	make_capture(capture, width, height, bytesPerRow / 4, seed);
+
+	DesktopTexture texture;
+	timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < builds; i++) {
+		texture.Build(&capture[0], width, height, bytesPerRow, maxWidth,
+			maxHeight);
+	}
+	double wallTime = elapsed_ms(CLOCK_MONOTONIC, start);
+
+	double captureBytes = (double)width * height * 4;
+	printf("capture: %dx%d, %.1f MB\n", width, height,
+		captureBytes / 1048576);
+	printf("texture: %dx%d, %d levels, %.1f MB (%.1f%% of the capture)\n",
+		texture.Width(), texture.Height(), texture.CountLevels(),
+		texture.Size() / 1048576.0, texture.Size() * 100.0 / captureBytes);
+	printf("build: %.2f ms, %.0f MB/s of capture\n", wallTime / builds,
+		captureBytes * builds / 1048576 / (wallTime / 1000));
+	printf("checksum: %016llx\n",
+		(unsigned long long)fnv1a_checksum(texture));
+
+	if (filePath != NULL) {
+		if (!texture.WriteFile(filePath, seed)) {
+			fprintf(stderr, "Could not write %s\n", filePath);
+			return 1;
+		}
+
+		DesktopTexture mapped;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		bool isMapped = mapped.MapFile(filePath, seed);
+		double mapTime = elapsed_ms(CLOCK_MONOTONIC, start);
+		if (!isMapped) {
+			fprintf(stderr, "Could not map %s\n", filePath);
+			return 1;
+		}
+		printf("map: %.3f ms, checksum: %016llx\n", mapTime,
+			(unsigned long long)fnv1a_checksum(mapped));
+	}
+
+	if (imagePath != NULL && !write_ppm(imagePath, texture)) {
+		fprintf(stderr, "Could not write %s\n", imagePath);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * tiles_benchmark.cpp
+ *
+ * Shattered desktop benchmark for Cosmic Desktop on Linux. Lets the tiles
+ * of the desktop fly apart for a number of frames, building their vertex
+ * array after every step as the view does, and reports the CPU time per
+ * frame and a checksum of the final vertices. The tiles are the same for
+ * the same grid and seed, so changes to the update can be measured and
+ * checked without a display.
+ *
+ * Usage: tiles_benchmark [-g columns x rows] [-f frames] [-d delta]
+ *            [-S seed]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "DesktopTiles.h"
+
+
+static double
+elapsed_ms(clockid_t clock, const timespec& start)
+{
+	timespec now;
+	clock_gettime(clock, &now);
+	return (now.tv_sec - start.tv_sec) * 1000.0
+		+ (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+
+static uint64_t
+fnv1a_checksum(const void* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-g columns x rows] [-f frames] [-d delta] "
+		"[-S seed]\n", name);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	int columns = 256;
+	int rows = 144;
+	int frames = 1000;
+	float delta = 0.01f;
+	unsigned seed = 1;
+
+	int option;
+	while ((option = getopt(argc, argv, "g:f:d:S:h")) != -1) {
+		switch (option) {
+			case 'g':
+				if (sscanf(optarg, "%dx%d", &columns, &rows) != 2) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'f':
+				frames = atoi(optarg);
+				break;
+			case 'd':
+				delta = atof(optarg);
+				break;
+			case 'S':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (columns < 1 || rows < 1 || frames < 1 || delta < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// The front face of the box at 16:9, lit as in the screen saver
+	DesktopTiles tiles;
+	tiles.Build(columns, rows, 0.9f, 0.9f * 9.0f / 16.0f, 0.9f, seed);
+	const float light[3] = { 1.0f, 1.0f, 2.0f };
+	tiles.SetLight(light, 0.1f, 0.8f);
+	std::vector<DesktopTiles::Vertex> vertices(tiles.CountVertices());
+
+	timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int frame = 0; frame < frames; frame++) {
+		tiles.Advance(delta);
+		tiles.GetVertices(&vertices[0], 1.0f);
+	}
+	double wallTime = elapsed_ms(CLOCK_MONOTONIC, start);
+
+	printf("tiles: %dx%d (%d), %d frames, %.3f/frame\n", columns, rows,
+		tiles.CountTiles(), frames, delta);
+	printf("time/frame: %.3f ms\n", wallTime / frames);
+	printf("checksum: %016llx\n", (unsigned long long)fnv1a_checksum(
+		&vertices[0], vertices.size() * sizeof(DesktopTiles::Vertex)));
+	return 0;
+}
@@ -7,6 +7,8 @@
  * Modified and Enhanced by: Gemini 1.5 Pro (AI Assistant by Google)
  */
 
+#define GL_GLEXT_PROTOTYPES 1
+
 #include <ScreenSaver.h>
 #include <LayoutBuilder.h>
 #include <GridLayoutBuilder.h>
@@ -18,18 +20,44 @@
 #include <StringView.h>
 #include <GLView.h>
 #include <GL/gl.h>
-#include <GL/glu.h>
+#include <GL/glext.h>
 #include <Slider.h>
+#include <CheckBox.h>
 #include <Bitmap.h>
 #include <Screen.h>
+#include <Directory.h>
+#include <FindDirectory.h>
+#include <Path.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <syslog.h>
 #include <time.h>
+#include <algorithm>
+#include <thread>
 #include <vector>
 #include <cmath>
 
+#include "DesktopCache.h"
+#include "DesktopTexture.h"
+#include "DesktopTiles.h"
+#include "GLState.h"
+#include "HandoffSlot.h"
+#include "Matrix4.h"
+#include "StarField.h"
+
 class CosmicDesktopConfigView;
 class CosmicDesktopGLView;
 
+static const int32 kDefaultStarCount = 1024;
+static const int32 kMaxStarCount = 500000;
+static const int32 kDefaultTileColumns = 64;
+static const int32 kMaxTileColumns = 256;
+static const int32 kMaxTileRows = 144;
+// Rows of the screen hashed to tell whether it changed since it was
+// captured
+static const int kSampleRows = 32;
+
 class CosmicDesktopSaver : public BScreenSaver {
 public:
 								CosmicDesktopSaver(BMessage* archive, image_id image);
@@ -44,11 +72,23 @@ public:
 	float						GetRotationSpeed();
 	void						SetWobbleAmplitude(float amplitude);
 	float						GetWobbleAmplitude();
+	void						SetStarCount(int32 count);
+	int32						GetStarCount();
+	void						SetShatter(bool shatter);
+	bool						GetShatter();
+	void						SetTileColumns(int32 columns);
+	int32						GetTileColumns();
+	void						SetReportStateChanges(bool report);
+	bool						GetReportStateChanges();
 
 private:
 	CosmicDesktopGLView*		fGLView;
 	float						fRotationSpeed;
 	float						fWobbleAmplitude;
+	int32						fStarCount;
+	bool						fShatter;
+	int32						fTileColumns;
+	bool						fReportStateChanges;
 };
 
 // --- CosmicDesktopConfigView ---
@@ -64,11 +104,19 @@ public:
 private:
 	static const uint32			kSpeedChanged = 'SpCh';
 	static const uint32			kAmplitudeChanged = 'AmCh';
+	static const uint32			kStarCountChanged = 'StCh';
+	static const uint32			kShatterChanged = 'ShCh';
+	static const uint32			kTileColumnsChanged = 'TiCh';
+	static const uint32			kReportChanged = 'RpCh';
 	CosmicDesktopSaver*			fSaver;
 	BStringView*				fNameStringView;
 	BTextView*					fInfoTextView;
 	BSlider*					fSpeedSlider;
 	BSlider*					fAmplitudeSlider;
+	BSlider*					fStarCountSlider;
+	BCheckBox*					fShatterCheckBox;
+	BSlider*					fTileColumnsSlider;
+	BCheckBox*					fReportCheckBox;
 };
 
 // --- CosmicDesktopGLView ---
@@ -76,16 +124,42 @@ private:
 class CosmicDesktopGLView : public BGLView {
 public:
 								CosmicDesktopGLView(BRect frame);
+								~CosmicDesktopGLView();
 
 	void						AttachedToWindow();
+	void						DetachedFromWindow();
 	void						Draw();
+	// Advances the animation by the time that passed since the last call
+	void						Animate();
 	void						Advance(float delta);
 	void						SetRotationSpeed(float speed);
 	void						SetWobbleAmplitude(float amplitude);
+	void						SetStarCount(int32 count);
+	void						SetShatter(bool shatter);
+	void						SetTileColumns(int32 columns);
 	void						SetPreviewMode(bool previewMode);
+	void						SetReportStateChanges(bool report)
+									{ fReportStateChanges = report; }
+
+	// GL state changes made by the last frame
+	int32						CountStateChanges() const
+									{ return fStateChanges; }
 
 private:
-	void						DrawStars(bool previewMode);
+	void						InitBox();
+	void						DrawBox();
+	void						InitStars();
+	void						UseStarProgram(bool use);
+	void						UploadStars();
+	void						StreamStarPositions();
+	void						DrawStars();
+	void						UploadTiles();
+	void						StreamTileVertices();
+	void						DrawTiles();
+	void						CaptureDesktop(screen_id screen, int maxWidth,
+									int maxHeight);
+	void						UploadTexture(const DesktopTexture& texture);
+	void						ReportStateChanges();
 	void						InitializeRotationVector();
 
 	float						SmoothStep(float edge0, float edge1, float x) {
@@ -93,7 +167,31 @@ private:
 		return x * x * (3 - 2 * x);
 	}
 
+	static constexpr float		FIELD_OF_VIEW = 45.0f;
+	static constexpr float		NEAR_PLANE = 0.1f;
+	static constexpr float		FAR_PLANE = 1000.0f;
 	static constexpr float		MAX_DISTANCE = 1.5f;
+	static constexpr float		CAMERA_DISTANCE = 2.12f;
+	// Half the width of the box, and of the desktop on its front face
+	static constexpr float		BOX_HALF_WIDTH = 0.9f;
+	// Smallest width of a tile of the shattered desktop in pixels. Smaller
+	// tiles do not look any different, but software GL spends most of a
+	// frame setting up their triangles.
+	static constexpr float		MIN_TILE_SIZE = 12.0f;
+	// Stars stream towards the camera at this many units per unit of
+	// animation time once the desktop has flown away
+	static constexpr float		WARP_SPEED = 200.0f;
+	// The desktop fades in over this much of the animation once it has
+	// been captured, before it starts to fly away
+	static constexpr float		FADE_TIME = 0.1f;
+	// Units of animation time per second, the pace the animation had with
+	// a fixed 0.01 per 25 ms tick
+	static constexpr float		ANIMATION_RATE = 0.4f;
+	// The animation is stepped by at most this much at a time
+	static constexpr float		MAX_STEP = 0.01f;
+	// After a longer pause the animation only goes on by this much, rather
+	// than jump ahead
+	static constexpr bigtime_t	MAX_ELAPSED_TIME = 250000;
 
 	float						fWidth;
 	float						fHeight;
@@ -101,8 +199,54 @@ private:
 	float						fRotationSpeed;
 	float						fRotationAngle;
 	float						fDistance;
+	bigtime_t					fLastAnimateTime;
 	GLuint						fTextureId;
 	bool						fPreviewMode;
+
+	// Each draw asks fState for the state it needs, which passes on and
+	// counts what changes
+	GLState						fState;
+	int32						fStateChanges;
+	// Summed up over the frames since the last report, which is only
+	// logged on request
+	bool						fReportStateChanges;
+	int32						fReportFrameCount;
+	int64						fStateChangeSum;
+	// The box is 16 vertices of position, normal and texture coordinates
+	GLuint						fBoxBuffer;
+	float						fMaterialFade;
+
+	// The screen of the view is captured and scaled on fCaptureThread,
+	// or taken from the cache if it has not changed, and the texture is
+	// uploaded by the first frame after it is ready
+	std::thread					fCaptureThread;
+	HandoffSlot<DesktopCache::TextureRef> fCapturedTexture;
+	// Set once the capture has been taken, whether it worked or not
+	bool						fCaptureFinished;
+	float						fDesktopFade;
+
+	// Stars are placed when the count changes. Their colors followed by
+	// their sizes stay in one buffer object, while the positions are
+	// streamed into the other after they moved. The point sizes need a
+	// vertex shader.
+	StarField					fStars;
+	int32						fStarCount;
+	bool						fStarsChanged;
+	bool						fStarsMoved;
+	GLuint						fStarBuffers[2];
+	GLuint						fStarProgram;
+	float						fStarPointSize;
+
+	// Instead of the box, the desktop can shatter into tiles. Their
+	// vertices are streamed into the first buffer object after they moved
+	// or faded, while their texture coordinates and triangles stay in the
+	// other two.
+	DesktopTiles				fTiles;
+	bool						fShatter;
+	int32						fTileColumns;
+	bool						fTilesChanged;
+	bool						fTilesMoved;
+	GLuint						fTileBuffers[3];
 	
 	float						fRotationX;
 	float						fRotationY;
@@ -119,7 +263,11 @@ CosmicDesktopSaver::CosmicDesktopSaver(BMessage* archive, image_id image)
 	BScreenSaver(archive, image),
 	fGLView(nullptr),
 	fRotationSpeed(5.0f),
-	fWobbleAmplitude(0.05f)
+	fWobbleAmplitude(0.05f),
+	fStarCount(kDefaultStarCount),
+	fShatter(false),
+	fTileColumns(kDefaultTileColumns),
+	fReportStateChanges(false)
 {
 	RestoreState(archive);
 }
@@ -137,6 +285,16 @@ status_t
 CosmicDesktopSaver::StartSaver(BView* view, bool preview)
 {
 	view->SetViewColor(0, 0, 0);
+
+	// The desktop texture is kept on disk, so that the next run only has
+	// to map it if the screen still shows the same
+	BPath cachePath;
+	if (find_directory(B_USER_CACHE_DIRECTORY, &cachePath) == B_OK
+		&& cachePath.Append("Cosmic Desktop") == B_OK
+		&& create_directory(cachePath.Path(), 0755) == B_OK) {
+		DesktopCache::Default().SetDirectory(cachePath.Path());
+	}
+
 	if (!fGLView) {
 		BRect bounds = view->Bounds();
 		fGLView = new CosmicDesktopGLView(bounds);
@@ -144,6 +302,10 @@ CosmicDesktopSaver::StartSaver(BView* view, bool preview)
 		fGLView->SetPreviewMode(preview);
 		fGLView->SetRotationSpeed(fRotationSpeed);
 		fGLView->SetWobbleAmplitude(fWobbleAmplitude);
+		fGLView->SetStarCount(fStarCount);
+		fGLView->SetShatter(fShatter);
+		fGLView->SetTileColumns(fTileColumns);
+		fGLView->SetReportStateChanges(fReportStateChanges);
 		view->AddChild(fGLView);
 	}
 	SetTickSize(25000);
@@ -156,6 +318,10 @@ CosmicDesktopSaver::SaveState(BMessage* into) const
 {
 	into->AddFloat("rotation_speed", fRotationSpeed);
 	into->AddFloat("wobble_amplitude", fWobbleAmplitude);
+	into->AddInt32("star_count", fStarCount);
+	into->AddBool("shatter", fShatter);
+	into->AddInt32("tile_columns", fTileColumns);
+	into->AddBool("report_state_changes", fReportStateChanges);
 	return B_OK;
 }
 
@@ -170,14 +336,37 @@ CosmicDesktopSaver::RestoreState(BMessage* from)
 		if (from->FindFloat("wobble_amplitude", &fWobbleAmplitude) != B_OK) {
 			fWobbleAmplitude = 0.05f;
 		}
+		if (from->FindInt32("star_count", &fStarCount) != B_OK) {
+			fStarCount = kDefaultStarCount;
+		}
+		if (from->FindBool("shatter", &fShatter) != B_OK) {
+			fShatter = false;
+		}
+		if (from->FindInt32("tile_columns", &fTileColumns) != B_OK) {
+			fTileColumns = kDefaultTileColumns;
+		}
+		if (from->FindBool("report_state_changes", &fReportStateChanges)
+				!= B_OK) {
+			fReportStateChanges = false;
+		}
 	} else {
 		fRotationSpeed = 5.0f;
 		fWobbleAmplitude = 0.05f;
+		fStarCount = kDefaultStarCount;
+		fShatter = false;
+		fTileColumns = kDefaultTileColumns;
+		fReportStateChanges = false;
 	}
+	fStarCount = std::max((int32)1, std::min(kMaxStarCount, fStarCount));
+	fTileColumns = std::max((int32)1, std::min(kMaxTileColumns, fTileColumns));
 
 	if (fGLView) {
 		fGLView->SetRotationSpeed(fRotationSpeed);
 		fGLView->SetWobbleAmplitude(fWobbleAmplitude);
+		fGLView->SetStarCount(fStarCount);
+		fGLView->SetShatter(fShatter);
+		fGLView->SetTileColumns(fTileColumns);
+		fGLView->SetReportStateChanges(fReportStateChanges);
 	}
 }
 
@@ -186,7 +375,7 @@ void
 CosmicDesktopSaver::Draw(BView* view, int32 frame)
 {
 	if (fGLView) {
-		fGLView->Advance(0.01f);
+		fGLView->Animate();
 		fGLView->Draw();
 	}
 }
@@ -225,6 +414,74 @@ CosmicDesktopSaver::GetWobbleAmplitude()
 	return fWobbleAmplitude;
 }
 
+
+void
+CosmicDesktopSaver::SetStarCount(int32 count)
+{
+	fStarCount = count;
+	if (fGLView) {
+		fGLView->SetStarCount(count);
+	}
+}
+
+
+int32
+CosmicDesktopSaver::GetStarCount()
+{
+	return fStarCount;
+}
+
+
+void
+CosmicDesktopSaver::SetShatter(bool shatter)
+{
+	fShatter = shatter;
+	if (fGLView) {
+		fGLView->SetShatter(shatter);
+	}
+}
+
+
+bool
+CosmicDesktopSaver::GetShatter()
+{
+	return fShatter;
+}
+
+
+void
+CosmicDesktopSaver::SetTileColumns(int32 columns)
+{
+	fTileColumns = columns;
+	if (fGLView) {
+		fGLView->SetTileColumns(columns);
+	}
+}
+
+
+int32
+CosmicDesktopSaver::GetTileColumns()
+{
+	return fTileColumns;
+}
+
+
+void
+CosmicDesktopSaver::SetReportStateChanges(bool report)
+{
+	fReportStateChanges = report;
+	if (fGLView) {
+		fGLView->SetReportStateChanges(report);
+	}
+}
+
+
+bool
+CosmicDesktopSaver::GetReportStateChanges()
+{
+	return fReportStateChanges;
+}
+
 // --- CosmicDesktopConfigView implementation ---
 
 CosmicDesktopConfigView::CosmicDesktopConfigView(BRect frame, CosmicDesktopSaver* saver)
@@ -267,6 +524,25 @@ CosmicDesktopConfigView::CosmicDesktopConfigView(BRect frame, CosmicDesktopSaver
 		0, 1000, B_HORIZONTAL);
 	fAmplitudeSlider->SetValue(fSaver->GetWobbleAmplitude() * 10000.0f);
 
+	// Create the star count slider, in thousands of stars
+	fStarCountSlider = new BSlider("starCountSlider", "Stars (thousands)",
+		new BMessage(kStarCountChanged), 1, kMaxStarCount / 1000, B_HORIZONTAL);
+	fStarCountSlider->SetValue(std::max((int32)1, fSaver->GetStarCount() / 1000));
+
+	// Create the shatter check box and the slider for the number of tiles
+	// across the desktop; the rows follow from its aspect ratio
+	fShatterCheckBox = new BCheckBox("shatterCheckBox", "Shatter the desktop",
+		new BMessage(kShatterChanged));
+	fShatterCheckBox->SetValue(fSaver->GetShatter() ? B_CONTROL_ON : B_CONTROL_OFF);
+	fTileColumnsSlider = new BSlider("tileColumnsSlider", "Tiles across",
+		new BMessage(kTileColumnsChanged), 1, kMaxTileColumns, B_HORIZONTAL);
+	fTileColumnsSlider->SetValue(fSaver->GetTileColumns());
+
+	fReportCheckBox = new BCheckBox("reportCheckBox",
+		"Log GL state changes to syslog", new BMessage(kReportChanged));
+	fReportCheckBox->SetValue(fSaver->GetReportStateChanges()
+		? B_CONTROL_ON : B_CONTROL_OFF);
+
 	// Use BGroupLayout for layout
 	BGroupLayout* layout = new BGroupLayout(B_VERTICAL);
 	SetLayout(layout);
@@ -276,6 +552,10 @@ CosmicDesktopConfigView::CosmicDesktopConfigView(BRect frame, CosmicDesktopSaver
 	layout->AddView(fNameStringView);
 	layout->AddView(fSpeedSlider);
 	layout->AddView(fAmplitudeSlider);
+	layout->AddView(fStarCountSlider);
+	layout->AddView(fShatterCheckBox);
+	layout->AddView(fTileColumnsSlider);
+	layout->AddView(fReportCheckBox);
 	layout->AddView(infoScrollView);
 }
 
@@ -285,6 +565,10 @@ CosmicDesktopConfigView::AttachedToWindow()
 {
 	fSpeedSlider->SetTarget(this);
 	fAmplitudeSlider->SetTarget(this);
+	fStarCountSlider->SetTarget(this);
+	fShatterCheckBox->SetTarget(this);
+	fTileColumnsSlider->SetTarget(this);
+	fReportCheckBox->SetTarget(this);
 }
 
 
@@ -298,6 +582,19 @@ CosmicDesktopConfigView::MessageReceived(BMessage* message)
 		case kAmplitudeChanged:
 			fSaver->SetWobbleAmplitude(fAmplitudeSlider->Value() / 10000.0f);
 			break;
+		case kStarCountChanged:
+			fSaver->SetStarCount(fStarCountSlider->Value() * 1000);
+			break;
+		case kShatterChanged:
+			fSaver->SetShatter(fShatterCheckBox->Value() == B_CONTROL_ON);
+			break;
+		case kTileColumnsChanged:
+			fSaver->SetTileColumns(fTileColumnsSlider->Value());
+			break;
+		case kReportChanged:
+			fSaver->SetReportStateChanges(
+				fReportCheckBox->Value() == B_CONTROL_ON);
+			break;
 		default:
 			BView::MessageReceived(message);
 	}
@@ -305,6 +602,84 @@ CosmicDesktopConfigView::MessageReceived(BMessage* message)
 
 // --- CosmicDesktopGLView implementation ---
 
+static bool
+GLVersionAtLeast(int major, int minor)
+{
+	const char* version = (const char*)glGetString(GL_VERSION);
+	int versionMajor = 0;
+	int versionMinor = 0;
+	if (version == NULL
+		|| sscanf(version, "%d.%d", &versionMajor, &versionMinor) != 2)
+		return false;
+
+	return versionMajor > major
+		|| (versionMajor == major && versionMinor >= minor);
+}
+
+
+// Hashes rows spread evenly over the screen, which takes a fraction of
+// the time of reading all of it
+static status_t
+HashScreenSample(BScreen& screen, uint64* hash)
+{
+	BRect frame = screen.Frame();
+	int width = frame.IntegerWidth() + 1;
+	int height = frame.IntegerHeight() + 1;
+	BBitmap* row = new BBitmap(BRect(0, 0, width - 1, 0), B_RGB32);
+	status_t status = row->InitCheck();
+
+	uint64 value = DesktopCache::HashStart(width, height);
+	int rows = std::min(kSampleRows, height);
+	for (int i = 0; i < rows && status == B_OK; i++) {
+		float y = frame.top + (2 * i + 1) * height / (2 * rows);
+		BRect bounds(frame.left, y, frame.right, y);
+		status = screen.ReadBitmap(row, false, &bounds);
+		if (status == B_OK) {
+			value = DesktopCache::HashPixels(value, (const uint32*)row->Bits(),
+				width);
+		}
+	}
+	delete row;
+
+	if (status == B_OK)
+		*hash = value;
+	return status;
+}
+
+
+// Reads all of the screen into the texture, or leaves it empty
+static void
+ReadScreen(BScreen& screen, int maxWidth, int maxHeight,
+	DesktopTexture& texture)
+{
+	BBitmap* screenshot = new BBitmap(screen.Frame(), B_RGB32);
+	if (screenshot->InitCheck() == B_OK && screen.ReadBitmap(screenshot) == B_OK) {
+		texture.Build(screenshot->Bits(), screenshot->Bounds().IntegerWidth() + 1,
+			screenshot->Bounds().IntegerHeight() + 1, screenshot->BytesPerRow(),
+			maxWidth, maxHeight);
+	}
+	delete screenshot;
+}
+
+
+// Directional light of the box, in world space
+static const GLfloat kLightPosition[] = { 1.0f, 1.0f, 2.0f, 0.0f };
+
+// Generic vertex attribute of the star shader; 0 aliases gl_Vertex
+static const GLuint kStarSizeAttribute = 1;
+
+// Transforms the stars like the fixed-function pipeline and gives each its
+// own point size
+static const char* kStarVertexShader =
+	"#version 120\n"
+	"attribute float size;\n"
+	"void main() {\n"
+	"	gl_Position = ftransform();\n"
+	"	gl_FrontColor = gl_Color;\n"
+	"	gl_PointSize = size;\n"
+	"}\n";
+
+
 CosmicDesktopGLView::CosmicDesktopGLView(BRect frame)
 	:
 	BGLView(frame, "CosmicDesktopGLView", B_FOLLOW_ALL, B_WILL_DRAW, BGL_RGB | BGL_DOUBLE | BGL_DEPTH),
@@ -313,17 +688,46 @@ CosmicDesktopGLView::CosmicDesktopGLView(BRect frame)
 	fRotationSpeed(5.0f),
 	fRotationAngle(0.0f),
 	fDistance(0.0f),
+	fLastAnimateTime(0),
+	fTextureId(0),
 	fPreviewMode(false),
+	fStateChanges(0),
+	fReportStateChanges(false),
+	fReportFrameCount(0),
+	fStateChangeSum(0),
+	fBoxBuffer(0),
+	fMaterialFade(-1.0f),
+	fCaptureFinished(false),
+	fDesktopFade(0.0f),
+	fStarCount(kDefaultStarCount),
+	fStarsChanged(true),
+	fStarsMoved(false),
+	fStarProgram(0),
+	fStarPointSize(1.0f),
+	fShatter(false),
+	fTileColumns(kDefaultTileColumns),
+	fTilesChanged(true),
+	fTilesMoved(false),
 	fWobbleAngle(0.0f),
 	fWobbleSpeed(2.0f),
 	fWobbleAmplitude(0.05f)
 {
+	fStarBuffers[0] = fStarBuffers[1] = 0;
+	fTileBuffers[0] = fTileBuffers[1] = fTileBuffers[2] = 0;
 	fAspectRatio = fWidth / fHeight;
 	srand(static_cast<unsigned int>(time(nullptr)));
 	InitializeRotationVector();
 }
 
 
+CosmicDesktopGLView::~CosmicDesktopGLView()
+{
+	// Reading the screen cannot be interrupted, but it does not take long
+	if (fCaptureThread.joinable())
+		fCaptureThread.join();
+}
+
+
 void
 CosmicDesktopGLView::InitializeRotationVector()
 {
@@ -345,214 +749,547 @@ CosmicDesktopGLView::AttachedToWindow()
 {
 	LockGL();
 
+	// State that no frame changes; what the draws switch between goes
+	// through fState
 	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_TEXTURE_2D);
 	glEnable(GL_POINT_SMOOTH);
+	glEnable(GL_LIGHT0);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	fState.SetClientState(GL_VERTEX_ARRAY, true);
 
-	// Capture screenshot and create texture
-	BScreen screen;
-	BBitmap* screenshot = new BBitmap(screen.Frame(), B_RGB32);
-	screen.ReadBitmap(screenshot);
+	// The light is directional, so the camera, which only moves, does not
+	// change where it comes from
+	glLightfv(GL_LIGHT0, GL_POSITION, kLightPosition);
 
-	glGenTextures(1, &fTextureId);
-	glBindTexture(GL_TEXTURE_2D, fTextureId);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, screenshot->Bounds().IntegerWidth() + 1,
-		screenshot->Bounds().IntegerHeight() + 1, 0, GL_BGRA, GL_UNSIGNED_BYTE,
-		screenshot->Bits());
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// Increase ambient light for better visibility
+	const GLfloat ambientLight[] = { 0.3f, 0.3f, 0.3f, 1.0f };
+	glLightfv(GL_LIGHT0, GL_AMBIENT, ambientLight);
 
-	delete screenshot;
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(Matrix4::Perspective(FIELD_OF_VIEW, fAspectRatio,
+		NEAR_PLANE, FAR_PLANE).Values());
+	glMatrixMode(GL_MODELVIEW);
+
+	InitStars();
+	InitBox();
+	glGenBuffers(3, fTileBuffers);
+
+	// The front face of the box starts out filling the view, so the
+	// texture never needs more pixels than the view has
+	GLint maxTextureSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
 
 	UnlockGL();
 
+	// The stars are drawn while the desktop is captured in the background
+	if (!fCaptureThread.joinable()) {
+		BScreen screen(Window());
+		fCaptureThread = std::thread(&CosmicDesktopGLView::CaptureDesktop,
+			this, screen.ID(), std::min((int)fWidth, (int)maxTextureSize),
+			std::min((int)fHeight, (int)maxTextureSize));
+	}
+
 	Draw();
 }
 
 
+void
+CosmicDesktopGLView::DetachedFromWindow()
+{
+	LockGL();
+
+	// GL unbinds deleted buffers, which fState has to know about; the
+	// texture stays, since the capture is not taken again
+	UseStarProgram(false);
+	fState.BindBuffer(GL_ARRAY_BUFFER, 0);
+	fState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glDeleteBuffers(1, &fBoxBuffer);
+	glDeleteBuffers(2, fStarBuffers);
+	glDeleteBuffers(3, fTileBuffers);
+	if (fStarProgram != 0)
+		glDeleteProgram(fStarProgram);
+
+	fBoxBuffer = 0;
+	fStarBuffers[0] = fStarBuffers[1] = 0;
+	fTileBuffers[0] = fTileBuffers[1] = fTileBuffers[2] = 0;
+	fStarProgram = 0;
+	// Attached again, the new buffers have to be filled
+	fStarsChanged = true;
+	fTilesChanged = true;
+
+	UnlockGL();
+	BGLView::DetachedFromWindow();
+}
+
+
+void
+CosmicDesktopGLView::CaptureDesktop(screen_id id, int maxWidth, int maxHeight)
+{
+	BScreen screen(id);
+	DesktopCache::Builder capture = [&screen, maxWidth, maxHeight](
+		DesktopTexture& texture) {
+		ReadScreen(screen, maxWidth, maxHeight, texture);
+	};
+
+	// Views on the same screen, and earlier runs through the texture
+	// files, share the capture as long as the screen shows the same
+	DesktopCache::TextureRef texture;
+	uint64 hash;
+	if (HashScreenSample(screen, &hash) == B_OK) {
+		texture = DesktopCache::Default().Get(id.id, hash, maxWidth,
+			maxHeight, capture);
+	} else {
+		DesktopTexture* captured = new DesktopTexture;
+		capture(*captured);
+		texture.reset(captured);
+	}
+
+	// An empty texture tells the view that there is nothing to wait for
+	fCapturedTexture.Publish(new DesktopCache::TextureRef(texture));
+}
+
+
+void
+CosmicDesktopGLView::UploadTexture(const DesktopTexture& texture)
+{
+	glGenTextures(1, &fTextureId);
+	glBindTexture(GL_TEXTURE_2D, fTextureId);
+
+	// B_RGB32 is laid out as GL_BGRA with GL_UNSIGNED_INT_8_8_8_8_REV, the
+	// format drivers store without swizzling it
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	for (int level = 0; level < texture.CountLevels(); level++) {
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, texture.Width(level),
+			texture.Height(level), 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+			texture.Bits(level));
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+		texture.CountLevels() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+
+// Logs the GL state changes per frame, on average over the last 250
+// frames
+void
+CosmicDesktopGLView::ReportStateChanges()
+{
+	fStateChangeSum += fStateChanges;
+	if (++fReportFrameCount < 250)
+		return;
+
+	syslog(LOG_INFO, "Cosmic Desktop: %.1f GL state changes/frame (%s)",
+		(double)fStateChangeSum / fReportFrameCount,
+		fTextureId == 0 ? "stars" : fShatter ? "tiles" : "box");
+	fReportFrameCount = 0;
+	fStateChangeSum = 0;
+}
+
+
 void
 CosmicDesktopGLView::Draw()
 {
 	LockGL();
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	DesktopCache::TextureRef* texture = fCapturedTexture.Take();
+	if (texture != NULL) {
+		// Without a desktop there is nothing to fade in, and the stars
+		// warp right away
+		if ((*texture)->CountLevels() > 0)
+			UploadTexture(**texture);
+		else
+			fDesktopFade = 1.0f;
+		fCaptureFinished = true;
+		delete texture;
+	}
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(45.0, fAspectRatio, 0.1, 1000.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	gluLookAt(0, 0, 2.12, 0, 0, 0, 0, 1, 0);
+	// The stars come first, since the desktop is blended over them, and
+	// nothing but stars until the desktop has been captured
+	DrawStars();
+	if (fTextureId != 0) {
+		if (fShatter)
+			DrawTiles();
+		else
+			DrawBox();
+	}
+	fStateChanges = fState.TakeChanges();
+	if (fReportStateChanges)
+		ReportStateChanges();
 
-	// Draw stars
-	DrawStars(fPreviewMode);
+	SwapBuffers();
+	UnlockGL();
+}
 
-	// Enable lighting
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
 
-	// Light position
-	GLfloat lightPos[] = { 1.0f, 1.0f, 2.0f, 0.0f };
-	glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
+void
+CosmicDesktopGLView::InitBox()
+{
+	float halfWidth = BOX_HALF_WIDTH;
+	float halfHeight = halfWidth / fAspectRatio;
+	const GLfloat vertices[16][8] = {
+		// Front face
+		{ -halfWidth, -halfHeight, halfWidth, 0, 0, 1, 0, 1 },
+		{ halfWidth, -halfHeight, halfWidth, 0, 0, 1, 1, 1 },
+		{ halfWidth, halfHeight, halfWidth, 0, 0, 1, 1, 0 },
+		{ -halfWidth, halfHeight, halfWidth, 0, 0, 1, 0, 0 },
+
+		// Back face
+		{ -halfWidth, -halfHeight, -halfWidth, 0, 0, -1, 1, 1 },
+		{ -halfWidth, halfHeight, -halfWidth, 0, 0, -1, 1, 0 },
+		{ halfWidth, halfHeight, -halfWidth, 0, 0, -1, 0, 0 },
+		{ halfWidth, -halfHeight, -halfWidth, 0, 0, -1, 0, 1 },
+
+		// Right face
+		{ halfWidth, -halfHeight, -halfWidth, 1, 0, 0, 1, 1 },
+		{ halfWidth, halfHeight, -halfWidth, 1, 0, 0, 1, 0 },
+		{ halfWidth, halfHeight, halfWidth, 1, 0, 0, 0, 0 },
+		{ halfWidth, -halfHeight, halfWidth, 1, 0, 0, 0, 1 },
+
+		// Left face
+		{ -halfWidth, -halfHeight, -halfWidth, -1, 0, 0, 0, 1 },
+		{ -halfWidth, -halfHeight, halfWidth, -1, 0, 0, 1, 1 },
+		{ -halfWidth, halfHeight, halfWidth, -1, 0, 0, 1, 0 },
+		{ -halfWidth, halfHeight, -halfWidth, -1, 0, 0, 0, 0 }
+	};
+
+	glGenBuffers(1, &fBoxBuffer);
+	fState.BindBuffer(GL_ARRAY_BUFFER, fBoxBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+}
 
-	// Increase ambient light for better visibility
-	GLfloat ambientLight[] = { 0.3f, 0.3f, 0.3f, 1.0f };
-	glLightfv(GL_LIGHT0, GL_AMBIENT, ambientLight);
 
-	glTranslatef(0, 0, -sqrt(fDistance));
-	
-	// Apply main rotation
-	glRotatef(fRotationAngle, fRotationX, fRotationY, fRotationZ);
-	
-	// Add wobble effect depending on distance
+void
+CosmicDesktopGLView::DrawBox()
+{
+	// The camera, the flight and turn of the box and its wobble, which
+	// depends on the distance, go to GL as one matrix
+	Matrix4 modelView = Matrix4::Translation(0, 0,
+			-CAMERA_DISTANCE - sqrtf(fDistance))
+		* Matrix4::Rotation(fRotationAngle, fRotationX, fRotationY, fRotationZ);
 	if (fDistance > MAX_DISTANCE / 2) {
 		float distanceFactor = SmoothStep(MAX_DISTANCE / 2, MAX_DISTANCE, fDistance);
 		float wobbleAmount = sin(fWobbleAngle) * fWobbleAmplitude * distanceFactor * (fWobbleSpeed / 2.0f);
-		glRotatef(wobbleAmount * 360.0f, fRotationY, fRotationZ, fRotationX);
+		modelView = modelView * Matrix4::Rotation(wobbleAmount * 360.0f,
+			fRotationY, fRotationZ, fRotationX);
+	}
+	fState.LoadMatrix(modelView.Values());
+
+	fState.SetEnabled(GL_TEXTURE_2D, true);
+	fState.SetEnabled(GL_LIGHTING, true);
+	fState.SetEnabled(GL_BLEND, true);
+	fState.SetClientState(GL_COLOR_ARRAY, false);
+	fState.SetClientState(GL_NORMAL_ARRAY, true);
+	fState.SetClientState(GL_TEXTURE_COORD_ARRAY, true);
+	UseStarProgram(false);
+
+	// Lit faces take their alpha from the material, which fades the
+	// desktop in
+	if (fMaterialFade != fDesktopFade) {
+		GLfloat diffuse[] = { 0.8f, 0.8f, 0.8f, fDesktopFade };
+		fState.SetMaterial(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
+		fMaterialFade = fDesktopFade;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, fTextureId);
+	const GLsizei stride = 8 * sizeof(GLfloat);
+	fState.BindBuffer(GL_ARRAY_BUFFER, fBoxBuffer);
+	glVertexPointer(3, GL_FLOAT, stride, NULL);
+	glNormalPointer(GL_FLOAT, stride, (const GLvoid*)(3 * sizeof(GLfloat)));
+	glTexCoordPointer(2, GL_FLOAT, stride, (const GLvoid*)(6 * sizeof(GLfloat)));
 
-	// Enable blending for transparency
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_QUADS, 0, 16);
+}
 
-	// Draw parallelepiped
-	float halfWidth = 0.9f;
-	float halfHeight = halfWidth / fAspectRatio;
-	float depth = halfWidth * 2;
-
-	glBegin(GL_QUADS);
-
-	// Front face (no transparency)
-	glNormal3f(0.0f, 0.0f, 1.0f);
-	glTexCoord2f(0, 1); glVertex3f(-halfWidth, -halfHeight, halfWidth);
-	glTexCoord2f(1, 1); glVertex3f(halfWidth, -halfHeight, halfWidth);
-	glTexCoord2f(1, 0); glVertex3f(halfWidth, halfHeight, halfWidth);
-	glTexCoord2f(0, 0); glVertex3f(-halfWidth, halfHeight, halfWidth);
-
-	// Back face (semi-transparent)
-	glNormal3f(0.0f, 0.0f, -1.0f);
-	glColor4f(1.0f, 1.0f, 1.0f, 0.8f); // 80% opacity
-	glTexCoord2f(1, 1); glVertex3f(-halfWidth, -halfHeight, -halfWidth);
-	glTexCoord2f(1, 0); glVertex3f(-halfWidth, halfHeight, -halfWidth);
-	glTexCoord2f(0, 0); glVertex3f(halfWidth, halfHeight, -halfWidth);
-	glTexCoord2f(0, 1); glVertex3f(halfWidth, -halfHeight, -halfWidth);
-
-	// Right face (semi-transparent)
-	glNormal3f(1.0f, 0.0f, 0.0f);
-	glColor4f(1.0f, 1.0f, 1.0f, 0.8f); // 80% opacity
-	glTexCoord2f(1, 1); glVertex3f(halfWidth, -halfHeight, -halfWidth);
-	glTexCoord2f(1, 0); glVertex3f(halfWidth, halfHeight, -halfWidth);
-	glTexCoord2f(0, 0); glVertex3f(halfWidth, halfHeight, halfWidth);
-	glTexCoord2f(0, 1); glVertex3f(halfWidth, -halfHeight, halfWidth);
-
-	// Left face (semi-transparent)
-	glNormal3f(-1.0f, 0.0f, 0.0f);
-	glColor4f(1.0f, 1.0f, 1.0f, 0.8f); // 80% opacity
-	glTexCoord2f(0, 1); glVertex3f(-halfWidth, -halfHeight, -halfWidth);
-	glTexCoord2f(1, 1); glVertex3f(-halfWidth, -halfHeight, halfWidth);
-	glTexCoord2f(1, 0); glVertex3f(-halfWidth, halfHeight, halfWidth);
-	glTexCoord2f(0, 0); glVertex3f(-halfWidth, halfHeight, -halfWidth);
-
-	glEnd();
-
-	// Disable blending and lighting
-	glDisable(GL_BLEND);
-	glDisable(GL_LIGHTING);
 
-	SwapBuffers();
-	UnlockGL();
+void
+CosmicDesktopGLView::InitStars()
+{
+	glGenBuffers(2, fStarBuffers);
+
+	// Per-star point sizes come from a vertex shader; without one, all
+	// stars share the average size
+	if (!GLVersionAtLeast(2, 0))
+		return;
+
+	GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(shader, 1, &kStarVertexShader, NULL);
+	glCompileShader(shader);
+	GLint compiled = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (compiled == GL_TRUE) {
+		GLuint program = glCreateProgram();
+		glAttachShader(program, shader);
+		glBindAttribLocation(program, kStarSizeAttribute, "size");
+		glLinkProgram(program);
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked == GL_TRUE) {
+			fStarProgram = program;
+			// Only takes effect while the program is used
+			glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+		} else
+			glDeleteProgram(program);
+	}
+	glDeleteShader(shader);
 }
 
 
 void
-CosmicDesktopGLView::DrawStars(bool previewMode)
+CosmicDesktopGLView::UseStarProgram(bool use)
 {
-	glDisable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (fStarProgram == 0)
+		return;
 
-	// Determine number of stars based on mode
-	int numStars = previewMode ? 64 : 1024;
-
-	// Generate random stars once on startup
-	static std::vector<GLfloat> starPositions;
-	static std::vector<GLfloat> starColors;
-	if (starPositions.empty()) {
-		// Calculate visible area boundaries
-		float aspectRatio = fWidth / fHeight;
-		float fovY = 45.0f; // vertical field of view in degrees
-		float fovX = fovY * aspectRatio;
-		float nearZ = 0.1f;
-		float farZ = 1500.0f;
-
-		float tanFovY = tan(fovY * M_PI / 180.0f / 2.0f);
-		float tanFovX = tan(fovX * M_PI / 180.0f / 2.0f);
-
-		for (int i = 0; i < numStars; ++i) {
-			// Generate stars within the visible pyramid
-			float z = -(rand() / (float)RAND_MAX * (farZ - nearZ) + nearZ);
-			float x = (rand() / (float)RAND_MAX * 2 - 1) * -z * tanFovX;
-			float y = (rand() / (float)RAND_MAX * 2 - 1) * -z * tanFovY;
-
-			starPositions.push_back(x);
-			starPositions.push_back(y);
-			starPositions.push_back(z);
-
-			float brightness = rand() / (float)RAND_MAX;
-			float colorVariation = 0.1f; // Maximum color deviation from white
-
-			// Create slight color variations
-			float r = brightness + (rand() % 201 - 100) / 1000.0f * colorVariation;
-			float g = brightness + (rand() % 201 - 100) / 1000.0f * colorVariation;
-			float b = brightness + (rand() % 201 - 100) / 1000.0f * colorVariation;
-
-			starColors.push_back(r);
-			starColors.push_back(g);
-			starColors.push_back(b);
-			starColors.push_back(brightness); // A
-		}
+	fState.UseProgram(use ? fStarProgram : 0);
+	fState.SetAttributeArray(kStarSizeAttribute, use);
+}
+
+
+void
+CosmicDesktopGLView::UploadStars()
+{
+	fStarsChanged = false;
+
+	// Stars are placed in the view volume of the projection used by Draw()
+	int count = fPreviewMode ? std::max((int32)64, fStarCount / 16) : fStarCount;
+	// Dense fields get smaller stars, down to half the size of the
+	// default one
+	float scale = std::max(0.5f, std::min(1.0f,
+		sqrtf((float)kDefaultStarCount / fStarCount)));
+	float minSize = fPreviewMode ? 0.5f : 2.0f * scale;
+	float maxSize = fPreviewMode ? 0.5f : 3.0f * scale;
+	fStars.Build(count, (uint32)rand(), FIELD_OF_VIEW, fAspectRatio,
+		NEAR_PLANE, FAR_PLANE, minSize, maxSize);
+
+	StreamStarPositions();
+
+	fState.BindBuffer(GL_ARRAY_BUFFER, fStarBuffers[1]);
+	glBufferData(GL_ARRAY_BUFFER, count * (sizeof(uint32) + sizeof(GLfloat)),
+		NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(uint32), fStars.Colors());
+	glBufferSubData(GL_ARRAY_BUFFER, count * sizeof(uint32),
+		count * sizeof(GLfloat), fStars.Sizes());
+
+	fStarPointSize = (minSize + maxSize) / 2;
+	if (fStarProgram == 0)
+		glPointSize(fStarPointSize);
+}
+
+
+void
+CosmicDesktopGLView::StreamStarPositions()
+{
+	fStarsMoved = false;
+
+	// The buffer is orphaned first, so that writing it does not have to
+	// wait for the last frame to be done with it
+	fState.BindBuffer(GL_ARRAY_BUFFER, fStarBuffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, fStars.CountStars() * 3 * sizeof(GLfloat),
+		NULL, GL_STREAM_DRAW);
+	GLfloat* positions = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+	if (positions != NULL) {
+		fStars.GetPositions(positions);
+		if (glUnmapBuffer(GL_ARRAY_BUFFER) != GL_TRUE)
+			fStarsMoved = true;
 	}
+}
 
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnableClientState(GL_COLOR_ARRAY);
 
-	glVertexPointer(3, GL_FLOAT, 0, &starPositions[0]);
-	glColorPointer(4, GL_FLOAT, 0, &starColors[0]);
+void
+CosmicDesktopGLView::DrawStars()
+{
+	if (fStarsChanged)
+		UploadStars();
+	else if (fStarsMoved)
+		StreamStarPositions();
+
+	int count = fStars.CountStars();
+
+	// The stars are placed in eye space
+	fState.LoadMatrix(Matrix4().Values());
+
+	fState.SetEnabled(GL_TEXTURE_2D, false);
+	fState.SetEnabled(GL_LIGHTING, false);
+	fState.SetEnabled(GL_BLEND, true);
+	fState.SetClientState(GL_COLOR_ARRAY, true);
+	fState.SetClientState(GL_NORMAL_ARRAY, false);
+	fState.SetClientState(GL_TEXTURE_COORD_ARRAY, false);
+	UseStarProgram(true);
+
+	fState.BindBuffer(GL_ARRAY_BUFFER, fStarBuffers[0]);
+	glVertexPointer(3, GL_FLOAT, 0, NULL);
+	fState.BindBuffer(GL_ARRAY_BUFFER, fStarBuffers[1]);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, NULL);
+	if (fStarProgram != 0) {
+		glVertexAttribPointer(kStarSizeAttribute, 1, GL_FLOAT, GL_FALSE, 0,
+			(const GLvoid*)(count * sizeof(uint32)));
+	}
 
-	glPointSize(previewMode ? 0.5f : (1.0f + 2.0f * ((rand() / (float)RAND_MAX) * 0.5f + 0.5f)));
-	glDrawArrays(GL_POINTS, 0, starPositions.size() / 3);
+	glDrawArrays(GL_POINTS, 0, count);
+}
 
-	glDisableClientState(GL_VERTEX_ARRAY);
-	glDisableClientState(GL_COLOR_ARRAY);
 
-	glDisable(GL_BLEND);
-	glEnable(GL_TEXTURE_2D);
+void
+CosmicDesktopGLView::UploadTiles()
+{
+	fTilesChanged = false;
+
+	// The tiles make up the front face of the box as it is before it
+	// starts to move, which fills the view
+	int columns = std::max(1, std::min((int)fTileColumns,
+		(int)(fWidth / MIN_TILE_SIZE)));
+	int rows = std::max(1, std::min((int)kMaxTileRows,
+		(int)(columns / fAspectRatio + 0.5f)));
+	fTiles.Build(columns, rows, BOX_HALF_WIDTH,
+		BOX_HALF_WIDTH / fAspectRatio, BOX_HALF_WIDTH, (uint32)rand());
+	// What the lighting of the box works out to for its material
+	fTiles.SetLight(kLightPosition, 0.1f, 0.8f);
+
+	std::vector<GLfloat> coordinates(fTiles.CountVertices() * 2);
+	fTiles.GetTextureCoordinates(&coordinates[0]);
+	fState.BindBuffer(GL_ARRAY_BUFFER, fTileBuffers[1]);
+	glBufferData(GL_ARRAY_BUFFER, coordinates.size() * sizeof(GLfloat),
+		&coordinates[0], GL_STATIC_DRAW);
+
+	// Separate triangles cost software GL less than quads, which it has to
+	// split itself
+	std::vector<GLuint> indices(fTiles.CountIndices());
+	fTiles.GetIndices(&indices[0]);
+	fState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, fTileBuffers[2]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
+		&indices[0], GL_STATIC_DRAW);
+
+	StreamTileVertices();
+}
+
+
+void
+CosmicDesktopGLView::StreamTileVertices()
+{
+	fTilesMoved = false;
+
+	// Orphaned first like the star positions
+	fState.BindBuffer(GL_ARRAY_BUFFER, fTileBuffers[0]);
+	glBufferData(GL_ARRAY_BUFFER,
+		fTiles.CountVertices() * sizeof(DesktopTiles::Vertex), NULL,
+		GL_STREAM_DRAW);
+	DesktopTiles::Vertex* vertices
+		= (DesktopTiles::Vertex*)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+	if (vertices != NULL) {
+		fTiles.GetVertices(vertices, fDesktopFade);
+		if (glUnmapBuffer(GL_ARRAY_BUFFER) != GL_TRUE)
+			fTilesMoved = true;
+	}
 }
 
 
+void
+CosmicDesktopGLView::DrawTiles()
+{
+	if (fTilesChanged)
+		UploadTiles();
+	else if (fTilesMoved)
+		StreamTileVertices();
+
+	// Shattered, the desktop is lit on the CPU and its tiles move on their
+	// own, which leaves only the camera to GL
+	fState.LoadMatrix(Matrix4::Translation(0, 0, -CAMERA_DISTANCE).Values());
+
+	fState.SetEnabled(GL_TEXTURE_2D, true);
+	fState.SetEnabled(GL_LIGHTING, false);
+	// Only fading tiles are translucent
+	fState.SetEnabled(GL_BLEND, fDesktopFade < 1.0f);
+	fState.SetClientState(GL_COLOR_ARRAY, true);
+	fState.SetClientState(GL_NORMAL_ARRAY, false);
+	fState.SetClientState(GL_TEXTURE_COORD_ARRAY, true);
+	UseStarProgram(false);
+
+	fState.BindBuffer(GL_ARRAY_BUFFER, fTileBuffers[0]);
+	glVertexPointer(3, GL_FLOAT, sizeof(DesktopTiles::Vertex), NULL);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(DesktopTiles::Vertex),
+		(const GLvoid*)offsetof(DesktopTiles::Vertex, color));
+	fState.BindBuffer(GL_ARRAY_BUFFER, fTileBuffers[1]);
+	glTexCoordPointer(2, GL_FLOAT, 0, NULL);
+	fState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, fTileBuffers[2]);
+
+	// All tiles in one go
+	glDrawElements(GL_TRIANGLES, fTiles.CountIndices(), GL_UNSIGNED_INT,
+		NULL);
+}
+
+
+void
+CosmicDesktopGLView::Animate()
+{
+	bigtime_t now = system_time();
+	bigtime_t elapsed = 0;
+	if (fLastAnimateTime != 0)
+		elapsed = std::min(now - fLastAnimateTime, MAX_ELAPSED_TIME);
+	fLastAnimateTime = now;
+
+	Advance(elapsed / 1000000.0f * ANIMATION_RATE);
+}
+
+
+// The fade, rotation, distance and wobble are stepped by at most MAX_STEP,
+// so they come out the same however delta is cut up. The stars and tiles
+// move along straight lines and are moved once, by all of the flight time.
 void
 CosmicDesktopGLView::Advance(float delta)
 {
-	fRotationAngle += fRotationSpeed * delta * 1.2f;
-	if (fRotationAngle > 360.0f) {
-		fRotationAngle -= 360.0f;
+	// Nothing moves until the capture is done, and then the desktop stays
+	// in place until it has faded in
+	if (!fCaptureFinished)
+		return;
+
+	float flightTime = 0.0f;
+	float starDistance = 0.0f;
+	while (delta > 0.0f) {
+		float step = std::min(delta, MAX_STEP);
+		delta -= step;
+
+		if (fDesktopFade < 1.0f) {
+			fDesktopFade = std::min(1.0f, fDesktopFade + step / FADE_TIME);
+			fTilesMoved = true;
+			continue;
+		}
+
+		fRotationAngle += fRotationSpeed * step * 1.2f;
+		if (fRotationAngle > 360.0f) {
+			fRotationAngle -= 360.0f;
+		}
+
+		fDistance += step;
+		if (fDistance > MAX_DISTANCE) {
+			fDistance = MAX_DISTANCE;
+		}
+
+		// Update wobble angle if we've passed half the distance
+		if (fDistance > MAX_DISTANCE / 2) {
+			float distanceFactor = (fDistance - MAX_DISTANCE / 2) / (MAX_DISTANCE / 2);
+			fWobbleAngle += fWobbleSpeed * step * distanceFactor;
+			if (fWobbleAngle > 2 * M_PI) {
+				fWobbleAngle -= 2 * M_PI;
+			}
+		}
+
+		// The stars pick up speed as the desktop flies away
+		starDistance += WARP_SPEED * SmoothStep(0.0f, MAX_DISTANCE, fDistance)
+			* step;
+		flightTime += step;
 	}
-	
-	fDistance += delta;
-	if (fDistance > MAX_DISTANCE) {
-		fDistance = MAX_DISTANCE;
+
+	if (fShatter && fTextureId != 0 && flightTime > 0.0f) {
+		fTiles.Advance(flightTime);
+		fTilesMoved = true;
 	}
-	
-	// Update wobble angle if we've passed half the distance
-	if (fDistance > MAX_DISTANCE / 2) {
-		float distanceFactor = (fDistance - MAX_DISTANCE / 2) / (MAX_DISTANCE / 2);
-		fWobbleAngle += fWobbleSpeed * delta * distanceFactor;
-		if (fWobbleAngle > 2 * M_PI) {
-			fWobbleAngle -= 2 * M_PI;
-		}
+	if (starDistance > 0.0f) {
+		fStars.Advance(starDistance);
+		fStarsMoved = true;
 	}
 }
 
@@ -571,10 +1308,43 @@ CosmicDesktopGLView::SetWobbleAmplitude(float amplitude)
 }
 
 
+void
+CosmicDesktopGLView::SetStarCount(int32 count)
+{
+	if (count != fStarCount) {
+		fStarCount = count;
+		fStarsChanged = true;
+	}
+}
+
+
+void
+CosmicDesktopGLView::SetShatter(bool shatter)
+{
+	if (shatter != fShatter) {
+		fShatter = shatter;
+		fTilesChanged = true;
+	}
+}
+
+
+void
+CosmicDesktopGLView::SetTileColumns(int32 columns)
+{
+	if (columns != fTileColumns) {
+		fTileColumns = columns;
+		fTilesChanged = true;
+	}
+}
+
+
 void
 CosmicDesktopGLView::SetPreviewMode(bool previewMode)
 {
-	fPreviewMode = previewMode;
+	if (previewMode != fPreviewMode) {
+		fPreviewMode = previewMode;
+		fStarsChanged = true;
+	}
 }
 
 // --- Entry point ---